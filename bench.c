@@ -0,0 +1,741 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h> //for mmap - keeps bookkeeping off the heap
+#include <time.h>
+#include "customAllocator.h"
+#include <pthread.h>
+#include <sched.h> //for sched_yield
+#include <stdio.h>
+#include <stdlib.h>
+
+/*=============================================================================
+* helpers
+=============================================================================*/
+static unsigned long long rngState = 88172645463325252ULL;
+
+static unsigned long long nextRandom() {
+  // xorshift64 - deterministic so runs are comparable
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return rngState;
+}
+
+static double nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// page provider that forwards to mmap and keeps count of the bytes mapped,
+// which is what the heap costs the process
+static size_t mappedBytes = 0;
+
+static void* countingMap(size_t size) {
+  size_t alignedSize = size + PAGE_PROVIDER_ALIGNMENT;
+  char* region = (char*)mmap(NULL, alignedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    return NULL;
+  }
+  char* aligned = (char*)(((size_t)region + PAGE_PROVIDER_ALIGNMENT - 1) & ~(size_t)(PAGE_PROVIDER_ALIGNMENT - 1));
+  if (aligned > region) {
+    munmap(region, (size_t)(aligned - region));
+  }
+  munmap(aligned + size, (size_t)(region + alignedSize - (aligned + size)));
+  __atomic_add_fetch(&mappedBytes, size, __ATOMIC_RELAXED);
+  return aligned;
+}
+
+static void countingUnmap(void* ptr, size_t size) {
+  __atomic_sub_fetch(&mappedBytes, size, __ATOMIC_RELAXED);
+  munmap(ptr, size);
+}
+
+static void countingPurge(void* ptr, size_t size) {
+  madvise(ptr, size, MADV_DONTNEED);
+}
+
+static void* countingRemap(void* ptr, size_t oldSize, size_t newSize) {
+  void* moved = mremap(ptr, oldSize, newSize, 0);
+  if (moved == MAP_FAILED) {
+    // moved mappings must stay aligned too
+    void* target = countingMap(newSize);
+    if (target == NULL) {
+      return NULL;
+    }
+    __atomic_sub_fetch(&mappedBytes, newSize, __ATOMIC_RELAXED);
+    moved = mremap(ptr, oldSize, newSize, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+    if (moved == MAP_FAILED) {
+      munmap(target, newSize);
+      return NULL;
+    }
+  }
+  __atomic_add_fetch(&mappedBytes, newSize - oldSize, __ATOMIC_RELAXED);
+  return moved;
+}
+
+static void** allocPointerArray(size_t count) {
+  void* arr = mmap(NULL, count * sizeof(void*), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return arr == MAP_FAILED ? NULL : (void**)arr;
+}
+
+// resident set of the whole process
+static size_t rssBytes() {
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (statm == NULL) {
+    return 0;
+  }
+  size_t pages = 0;
+  size_t residentPages = 0;
+  if (fscanf(statm, "%zu %zu", &pages, &residentPages) != 2) {
+    residentPages = 0;
+  }
+  fclose(statm);
+  return residentPages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// the allocators every comparison runs against. the MT heap must be created
+// by the caller
+typedef struct {
+  const char* name;
+  void* (*mallocFn)(size_t);
+  void (*freeFn)(void*);
+  void* (*callocFn)(size_t, size_t);
+  void* (*reallocFn)(void*, size_t);
+} allocator_t;
+
+static const allocator_t allocators[] = {
+  {"customMalloc", customMalloc, customFree, customCalloc, customRealloc},
+  {"customMTMalloc", customMTMalloc, customMTFree, customMTCalloc, customMTRealloc},
+  {"glibc malloc", malloc, free, calloc, realloc},
+};
+#define ALLOCATOR_COUNT (sizeof(allocators) / sizeof(allocators[0]))
+
+// timings are taken per batch of SAMPLE_OPS operations, so the clock does not
+// dominate; the percentiles are over the ns/op of the batches
+#define SAMPLE_OPS (64)
+
+static int compareDoubles(const void* a, const void* b) {
+  double left = *(const double*)a;
+  double right = *(const double*)b;
+  return left < right ? -1 : left > right;
+}
+
+static double meanMops(const double* samples, size_t count) {
+  double total = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += samples[i];
+  }
+  return 1e3 * (double)count / total;
+}
+
+// one result line; sorts the samples
+static void printTiming(const char* allocator, const char* label, double mops, double* samples, size_t count, const char* extra) {
+  qsort(samples, count, sizeof(double), compareDoubles);
+  printf("%-16s %-12s %8.2f Mops/s  p50 %7.1f  p90 %7.1f  p99 %7.1f  max %10.1f ns/op  %s\n", allocator, label, mops,
+         samples[count / 2], samples[count * 9 / 10], samples[count * 99 / 100], samples[count - 1], extra);
+}
+
+static void formatRssGrowth(char* out, size_t outSize, size_t before, size_t after) {
+  snprintf(out, outSize, "rss +%zu KB", after > before ? (after - before) / 1024 : 0);
+}
+
+/*=============================================================================
+* benchmarks
+=============================================================================*/
+
+// malloc/free cost with a growing number of live blocks. every other block is
+// freed so the heap is full of holes, which is the worst case for a linear fit.
+void bench_live_blocks(size_t liveBlocks, size_t ops) {
+  void** live = allocPointerArray(liveBlocks);
+  if (live == NULL) {
+    printf("bench_live_blocks: mmap failed\n");
+    return;
+  }
+  for (size_t i = 0; i < liveBlocks; i++) {
+    live[i] = customMalloc(4 + (nextRandom() % 8) * 4);
+  }
+  for (size_t i = 0; i < liveBlocks; i += 2) {
+    customFree(live[i]);
+    live[i] = NULL;
+  }
+
+  double start = nowNs();
+  for (size_t i = 0; i < ops; i++) {
+    void* ptr = customMalloc(4 + (nextRandom() % 8) * 4);
+    customFree(ptr);
+  }
+  double elapsed = nowNs() - start;
+  printf("live blocks: %10zu  malloc+free: %8.1f ns/op\n", liveBlocks, elapsed / (double)ops);
+
+  for (size_t i = liveBlocks; i > 0; i--) {
+    if (live[i - 1] != NULL) {
+      customFree(live[i - 1]);
+    }
+  }
+  munmap(live, liveBlocks * sizeof(void*));
+}
+
+// mixed-size churn: mostly small objects with occasional large buffers. reports
+// the bytes the caller asked for against all the bytes the heap has mapped,
+// the segment kept from earlier runs and the address map included.
+static size_t churnSize() {
+  unsigned long long r = nextRandom() % 100;
+  if (r < 70) {
+    return 1 + nextRandom() % 64;
+  }
+  if (r < 95) {
+    return 64 + nextRandom() % 448;
+  }
+  return 512 + nextRandom() % 3584;
+}
+
+void bench_fragmentation(size_t slots, size_t ops) {
+  void** live = allocPointerArray(slots);
+  size_t* sizes = (size_t*)allocPointerArray(slots);
+  if (live == NULL || sizes == NULL) {
+    printf("bench_fragmentation: mmap failed\n");
+    return;
+  }
+  size_t requested = 0;
+  size_t peakRequested = 0;
+  size_t peakConsumed = 0;
+  for (size_t i = 0; i < ops; i++) {
+    size_t slot = nextRandom() % slots;
+    if (live[slot] != NULL) {
+      customFree(live[slot]);
+      requested -= sizes[slot];
+    }
+    sizes[slot] = churnSize();
+    live[slot] = customMalloc(sizes[slot]);
+    requested += sizes[slot];
+
+    size_t consumed = mappedBytes;
+    if (requested > peakRequested) {
+      peakRequested = requested;
+    }
+    if (consumed > peakConsumed) {
+      peakConsumed = consumed;
+    }
+  }
+  size_t consumed = mappedBytes;
+  printf("slots: %zu  ops: %zu\n", slots, ops);
+  printf("  final: requested %10zu B  consumed %10zu B  (%.2fx)\n", requested, consumed, (double)consumed / (double)requested);
+  printf("  peak:  requested %10zu B  consumed %10zu B  (%.2fx)\n", peakRequested, peakConsumed, (double)peakConsumed / (double)peakRequested);
+
+  for (size_t i = slots; i > 0; i--) {
+    if (live[i - 1] != NULL) {
+      customFree(live[i - 1]);
+    }
+  }
+  munmap(live, slots * sizeof(void*));
+  munmap(sizes, slots * sizeof(size_t));
+}
+
+// growing buffers, like vectors and string builders: a few live buffers are
+// grown by small appends in turn until they reach maxSize, then replaced.
+// reports the cost per realloc and how many of them had to move the data.
+typedef void* (*realloc_fn_t)(void*, size_t);
+typedef void (*free_fn_t)(void*);
+
+#define REALLOC_BUFFERS (4)
+
+static void run_realloc_growth(const char* name, realloc_fn_t reallocFn, free_fn_t freeFn, size_t maxSize, size_t ops) {
+  void* buffers[REALLOC_BUFFERS] = {NULL};
+  size_t sizes[REALLOC_BUFFERS] = {0};
+  size_t moves = 0;
+  double start = nowNs();
+  for (size_t i = 0; i < ops; i++) {
+    size_t slot = nextRandom() % REALLOC_BUFFERS;
+    if (sizes[slot] >= maxSize) {
+      freeFn(buffers[slot]);
+      buffers[slot] = NULL;
+      sizes[slot] = 0;
+    }
+    sizes[slot] += 16 + nextRandom() % 48;
+    void* grown = reallocFn(buffers[slot], sizes[slot]);
+    if (grown != buffers[slot] && buffers[slot] != NULL) {
+      moves++;
+    }
+    buffers[slot] = grown;
+    ((char*)grown)[sizes[slot] - 1] = (char)i;
+  }
+  double elapsed = nowNs() - start;
+  for (size_t slot = 0; slot < REALLOC_BUFFERS; slot++) {
+    if (buffers[slot] != NULL) {
+      freeFn(buffers[slot]);
+    }
+  }
+  printf("%-16s max %6zu B  %8.1f ns/realloc  moved %5.1f%%\n", name, maxSize, elapsed / (double)ops, 100.0 * (double)moves / (double)ops);
+}
+
+void bench_realloc_growth(size_t ops) {
+  for (size_t maxSize = 1024; maxSize <= 64 * 1024; maxSize *= 8) {
+    run_realloc_growth("customRealloc", customRealloc, customFree, maxSize, ops);
+  }
+  HeapConfig config;
+  heapDefaultConfig(&config);
+  config.largeThreshold = 128 * 1024;
+  heapCreateWithConfig(&config);
+  for (size_t maxSize = 1024; maxSize <= 64 * 1024; maxSize *= 8) {
+    run_realloc_growth("customMTRealloc", customMTRealloc, customMTFree, maxSize, ops);
+  }
+  heapKill();
+  for (size_t maxSize = 1024; maxSize <= 64 * 1024; maxSize *= 8) {
+    run_realloc_growth("glibc realloc", realloc, free, maxSize, ops);
+  }
+}
+
+// fixed-size objects: a window of live 48-byte nodes churned through a slab
+// and through the general MT heap
+#define SLAB_BENCH_WINDOW (4096)
+
+void bench_slab(size_t ops) {
+  static void* window[SLAB_BENCH_WINDOW];
+  Slab* slab = slabCreate(48);
+  memset(window, 0, sizeof(window));
+  double start = nowNs();
+  for (size_t i = 0; i < ops; i++) {
+    size_t slot = nextRandom() % SLAB_BENCH_WINDOW;
+    if (window[slot] != NULL) {
+      slabFree(slab, window[slot]);
+    }
+    window[slot] = slabAlloc(slab);
+  }
+  double elapsed = nowNs() - start;
+  printf("slabAlloc/slabFree          %8.1f ns/op\n", elapsed / (double)ops);
+  slabDestroy(slab);
+
+  heapCreate();
+  memset(window, 0, sizeof(window));
+  start = nowNs();
+  for (size_t i = 0; i < ops; i++) {
+    size_t slot = nextRandom() % SLAB_BENCH_WINDOW;
+    if (window[slot] != NULL) {
+      customMTFree(window[slot]);
+    }
+    window[slot] = customMTMalloc(48);
+  }
+  elapsed = nowNs() - start;
+  printf("customMTMalloc/customMTFree %8.1f ns/op\n", elapsed / (double)ops);
+  heapKill();
+}
+
+// request handler pattern: allocate a batch of objects, free them all. the
+// objects are above the thread cache range so every call reaches an area
+#define BATCH_BENCH_COUNT (32)
+
+void bench_batch(size_t rounds) {
+  void* ptrs[BATCH_BENCH_COUNT];
+  heapCreate();
+  double start = nowNs();
+  for (size_t round = 0; round < rounds; round++) {
+    for (size_t i = 0; i < BATCH_BENCH_COUNT; i++) {
+      ptrs[i] = customMTMalloc(512);
+    }
+    for (size_t i = 0; i < BATCH_BENCH_COUNT; i++) {
+      customMTFree(ptrs[i]);
+    }
+  }
+  double elapsed = nowNs() - start;
+  printf("one by one  %8.1f ns/object\n", elapsed / (double)(rounds * BATCH_BENCH_COUNT));
+
+  start = nowNs();
+  for (size_t round = 0; round < rounds; round++) {
+    customMTMallocBatch(512, BATCH_BENCH_COUNT, ptrs);
+    customMTFreeBatch(ptrs, BATCH_BENCH_COUNT);
+  }
+  elapsed = nowNs() - start;
+  printf("batched     %8.1f ns/object\n", elapsed / (double)(rounds * BATCH_BENCH_COUNT));
+  heapKill();
+}
+
+// scoped lifetimes: every request allocates a few hundred small objects that
+// all die together, freed one by one or dropped with a region reset
+#define REGION_BENCH_OBJECTS (256)
+
+void bench_region(size_t requests) {
+  void* ptrs[REGION_BENCH_OBJECTS];
+  double start = nowNs();
+  for (size_t r = 0; r < requests; r++) {
+    for (size_t i = 0; i < REGION_BENCH_OBJECTS; i++) {
+      ptrs[i] = customMalloc(16 + nextRandom() % 112);
+    }
+    for (size_t i = 0; i < REGION_BENCH_OBJECTS; i++) {
+      customFree(ptrs[i]);
+    }
+  }
+  double elapsed = nowNs() - start;
+  printf("customMalloc/customFree  %8.1f ns/object\n", elapsed / (double)(requests * REGION_BENCH_OBJECTS));
+
+  Region* region = regionCreate(16 * 1024);
+  start = nowNs();
+  for (size_t r = 0; r < requests; r++) {
+    for (size_t i = 0; i < REGION_BENCH_OBJECTS; i++) {
+      ptrs[i] = regionAlloc(region, 16 + nextRandom() % 112);
+    }
+    regionReset(region);
+  }
+  elapsed = nowNs() - start;
+  printf("regionAlloc/regionReset  %8.1f ns/object\n", elapsed / (double)(requests * REGION_BENCH_OBJECTS));
+  regionDestroy(region);
+}
+
+/*=============================================================================
+* allocator comparison
+* the same workloads against customMalloc, customMTMalloc and glibc
+=============================================================================*/
+
+// malloc/free pairs of one size
+void suite_pairs(const allocator_t* allocator, size_t size, size_t rounds, double* samples) {
+  for (size_t round = 0; round < rounds; round++) {
+    double start = nowNs();
+    for (size_t i = 0; i < SAMPLE_OPS; i++) {
+      void* ptr = allocator->mallocFn(size);
+      *(volatile char*)ptr = 0;
+      allocator->freeFn(ptr);
+    }
+    samples[round] = (nowNs() - start) / SAMPLE_OPS;
+  }
+  char label[32];
+  snprintf(label, sizeof(label), "%zu B", size);
+  printTiming(allocator->name, label, meanMops(samples, rounds), samples, rounds, "");
+}
+
+// random sizes replacing random slots; RSS is taken with the window full
+void suite_churn(const allocator_t* allocator, size_t slots, size_t rounds, double* samples) {
+  void** live = allocPointerArray(slots);
+  size_t rssBefore = rssBytes();
+  for (size_t round = 0; round < rounds; round++) {
+    double start = nowNs();
+    for (size_t i = 0; i < SAMPLE_OPS; i++) {
+      size_t slot = nextRandom() % slots;
+      if (live[slot] != NULL) {
+        allocator->freeFn(live[slot]);
+      }
+      live[slot] = allocator->mallocFn(churnSize());
+    }
+    samples[round] = (nowNs() - start) / SAMPLE_OPS;
+  }
+  size_t rssAfter = rssBytes();
+  for (size_t slot = 0; slot < slots; slot++) {
+    if (live[slot] != NULL) {
+      allocator->freeFn(live[slot]);
+    }
+  }
+  munmap(live, slots * sizeof(void*));
+  char rss[32];
+  formatRssGrowth(rss, sizeof(rss), rssBefore, rssAfter);
+  printTiming(allocator->name, "churn", meanMops(samples, rounds), samples, rounds, rss);
+}
+
+// count blocks allocated, then freed newest first (LIFO) or oldest first (FIFO)
+void suite_free_order(const allocator_t* allocator, size_t count, size_t rounds, bool lifo, double* samples) {
+  void** ptrs = allocPointerArray(count);
+  for (size_t round = 0; round < rounds; round++) {
+    double start = nowNs();
+    for (size_t i = 0; i < count; i++) {
+      ptrs[i] = allocator->mallocFn(16 + (i * 40) % 240);
+    }
+    for (size_t i = 0; i < count; i++) {
+      allocator->freeFn(ptrs[lifo ? count - 1 - i : i]);
+    }
+    samples[round] = (nowNs() - start) / (double)(2 * count);
+  }
+  munmap(ptrs, count * sizeof(void*));
+  printTiming(allocator->name, lifo ? "LIFO" : "FIFO", meanMops(samples, rounds), samples, rounds, "");
+}
+
+// large zeroed arrays, read back once so zeroing cannot be skipped unseen
+void suite_calloc(const allocator_t* allocator, size_t size, size_t rounds, double* samples) {
+  for (size_t round = 0; round < rounds; round++) {
+    double start = nowNs();
+    char* array = (char*)allocator->callocFn(size / 8, 8);
+    volatile char sink = array[size / 2];
+    (void)sink;
+    allocator->freeFn(array);
+    samples[round] = nowNs() - start;
+  }
+  char label[32];
+  snprintf(label, sizeof(label), "%zu KB", size / 1024);
+  printTiming(allocator->name, label, meanMops(samples, rounds), samples, rounds, "");
+}
+
+// the slower workloads run a fraction of the rounds, but always one
+static size_t fractionOfRounds(size_t rounds, size_t divisor) {
+  return rounds / divisor > 0 ? rounds / divisor : 1;
+}
+
+void bench_suite(size_t rounds) {
+  rounds = fractionOfRounds(rounds, 1);
+  double* samples = (double*)allocPointerArray(rounds);
+  heapCreate();
+  printf("==== suite: malloc/free pairs by size ====\n");
+  for (size_t size = 16; size <= 64 * 1024; size *= 4) {
+    for (size_t a = 0; a < ALLOCATOR_COUNT; a++) {
+      suite_pairs(&allocators[a], size, rounds, samples);
+    }
+  }
+  printf("==== suite: random size churn ====\n");
+  for (size_t a = 0; a < ALLOCATOR_COUNT; a++) {
+    suite_churn(&allocators[a], 10000, rounds, samples);
+  }
+  printf("==== suite: free order ====\n");
+  for (size_t a = 0; a < ALLOCATOR_COUNT; a++) {
+    suite_free_order(&allocators[a], 1024, fractionOfRounds(rounds, 64), true, samples);
+    suite_free_order(&allocators[a], 1024, fractionOfRounds(rounds, 64), false, samples);
+  }
+  printf("==== suite: calloc of large arrays ====\n");
+  for (size_t size = 64 * 1024; size <= 16 * 1024 * 1024; size *= 16) {
+    for (size_t a = 0; a < ALLOCATOR_COUNT; a++) {
+      suite_calloc(&allocators[a], size, fractionOfRounds(rounds, 256), samples);
+    }
+  }
+  heapKill();
+  munmap(samples, rounds * sizeof(double));
+}
+
+// multi thread throughput: every thread churns a small window of live small
+// objects. each thread times itself, so a thread that gets the CPU late on a
+// busy machine does not shorten the run
+typedef struct {
+  pthread_barrier_t* startBarrier;
+  const allocator_t* allocator;
+  size_t ops;
+  unsigned long long seed;
+  double start;
+  double end;
+  double* samples; // ns/op of each SAMPLE_OPS batch
+} mt_bench_arg_t;
+
+#define MT_BENCH_WINDOW (16)
+
+// BENCH_LOCK_PROFILE=1 dumps the lock profile of every multi thread run
+static int lockProfile = 0;
+
+void* mt_scaling_worker(void* p) {
+  mt_bench_arg_t* a = (mt_bench_arg_t*)p;
+  const allocator_t* allocator = a->allocator;
+  void* window[MT_BENCH_WINDOW] = {NULL};
+  unsigned long long seed = a->seed;
+  pthread_barrier_wait(a->startBarrier);
+  a->start = nowNs();
+  double batchStart = a->start;
+  for (size_t i = 0; i < a->ops; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    size_t slot = seed % MT_BENCH_WINDOW;
+    if (window[slot] != NULL) {
+      allocator->freeFn(window[slot]);
+    }
+    window[slot] = allocator->mallocFn(8 + (seed >> 8) % 120);
+    if ((i + 1) % SAMPLE_OPS == 0) {
+      double now = nowNs();
+      a->samples[i / SAMPLE_OPS] = (now - batchStart) / SAMPLE_OPS;
+      batchStart = now;
+    }
+  }
+  a->end = nowNs();
+  for (size_t slot = 0; slot < MT_BENCH_WINDOW; slot++) {
+    if (window[slot] != NULL) {
+      allocator->freeFn(window[slot]);
+    }
+  }
+  return NULL;
+}
+
+void bench_mt_scaling(const allocator_t* allocator, int threads, size_t opsPerThread) {
+  pthread_t th[threads];
+  mt_bench_arg_t args[threads];
+  pthread_barrier_t barrier;
+  size_t samplesPerThread = opsPerThread / SAMPLE_OPS;
+  double* samples = (double*)allocPointerArray(samplesPerThread * threads);
+  pthread_barrier_init(&barrier, NULL, threads + 1);
+  for (int i = 0; i < threads; i++) {
+    args[i].startBarrier = &barrier;
+    args[i].allocator = allocator;
+    args[i].ops = opsPerThread;
+    args[i].seed = 0x9E3779B97F4A7C15ULL * (unsigned long long)(i + 1);
+    args[i].samples = samples + samplesPerThread * i;
+    pthread_create(&th[i], NULL, mt_scaling_worker, &args[i]);
+  }
+  // threads exist before the heap so their creation does not touch it
+  heapCreate();
+  customLockProfileReset();
+  size_t rssBefore = rssBytes();
+  pthread_barrier_wait(&barrier);
+  for (int i = 0; i < threads; i++) {
+    pthread_join(th[i], NULL);
+  }
+  pthread_barrier_destroy(&barrier);
+  size_t rssAfter = rssBytes();
+  if (lockProfile) {
+    customLockProfileDump();
+  }
+  heapKill();
+  double start = args[0].start;
+  double end = args[0].end;
+  for (int i = 1; i < threads; i++) {
+    start = args[i].start < start ? args[i].start : start;
+    end = args[i].end > end ? args[i].end : end;
+  }
+  double elapsed = end - start;
+  double totalOps = (double)opsPerThread * threads;
+  char label[32];
+  char rss[32];
+  snprintf(label, sizeof(label), "%d threads", threads);
+  formatRssGrowth(rss, sizeof(rss), rssBefore, rssAfter);
+  printTiming(allocator->name, label, totalOps / elapsed * 1e3, samples, samplesPerThread * threads, rss);
+  munmap(samples, samplesPerThread * threads * sizeof(double));
+}
+
+// producer/consumer ping-pong: two threads each allocate blocks and hand them
+// to the other one, which frees them. every free is a cross-thread free.
+#define PING_PONG_RING (64)
+
+typedef struct {
+  void* slots[PING_PONG_RING];
+  size_t head; // next slot the producer writes
+  size_t tail; // next slot the consumer reads
+  int done; // the producer has pushed its last block
+} ping_pong_ring_t;
+
+typedef struct {
+  pthread_barrier_t* startBarrier;
+  ping_pong_ring_t* outgoing;
+  ping_pong_ring_t* incoming;
+  size_t ops;
+  unsigned long long seed;
+} ping_pong_arg_t;
+
+static void ping_pong_drain(ping_pong_ring_t* ring) {
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  size_t tail = ring->tail;
+  while (tail != head) {
+    customMTFree(ring->slots[tail % PING_PONG_RING]);
+    tail++;
+  }
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+void* ping_pong_worker(void* p) {
+  ping_pong_arg_t* a = (ping_pong_arg_t*)p;
+  unsigned long long seed = a->seed;
+  ping_pong_ring_t* out = a->outgoing;
+  pthread_barrier_wait(a->startBarrier);
+  for (size_t i = 0; i < a->ops; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    // half of the blocks are too big for the thread caches
+    size_t size = (seed & 1) ? 8 + (seed >> 8) % 248 : 264 + (seed >> 8) % 760;
+    void* ptr = customMTMalloc(size);
+    while (out->head - __atomic_load_n(&out->tail, __ATOMIC_ACQUIRE) == PING_PONG_RING) {
+      ping_pong_drain(a->incoming);
+      sched_yield();
+    }
+    out->slots[out->head % PING_PONG_RING] = ptr;
+    __atomic_store_n(&out->head, out->head + 1, __ATOMIC_RELEASE);
+    ping_pong_drain(a->incoming);
+  }
+  // keep consuming until the other side is done too
+  __atomic_store_n(&out->done, 1, __ATOMIC_RELEASE);
+  while (!__atomic_load_n(&a->incoming->done, __ATOMIC_ACQUIRE)) {
+    ping_pong_drain(a->incoming);
+    sched_yield();
+  }
+  ping_pong_drain(a->incoming);
+  pthread_barrier_wait(a->startBarrier);
+  return NULL;
+}
+
+void bench_mt_ping_pong(size_t opsPerThread) {
+  static ping_pong_ring_t rings[2];
+  memset(rings, 0, sizeof(rings));
+  pthread_t th[2];
+  ping_pong_arg_t args[2];
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, 3);
+  for (int i = 0; i < 2; i++) {
+    args[i].startBarrier = &barrier;
+    args[i].outgoing = &rings[i];
+    args[i].incoming = &rings[1 - i];
+    args[i].ops = opsPerThread;
+    args[i].seed = 0x9E3779B97F4A7C15ULL * (unsigned long long)(i + 1);
+    pthread_create(&th[i], NULL, ping_pong_worker, &args[i]);
+  }
+  // areas big enough that each thread's home area holds its blocks in flight
+  HeapConfig config;
+  heapDefaultConfig(&config);
+  config.initialAreaCount = 2;
+  config.areaSize = 64 * 1024;
+  heapCreateWithConfig(&config);
+  customLockProfileReset();
+  pthread_barrier_wait(&barrier);
+  double start = nowNs();
+  pthread_barrier_wait(&barrier);
+  double elapsed = nowNs() - start;
+  for (int i = 0; i < 2; i++) {
+    pthread_join(th[i], NULL);
+  }
+  pthread_barrier_destroy(&barrier);
+  if (lockProfile) {
+    customLockProfileDump();
+  }
+  heapKill();
+  double totalOps = (double)opsPerThread * 2;
+  printf("threads:   2  %8.2f Mops/s  %8.1f ns per malloc+remote free\n", totalOps / elapsed * 1e3, elapsed / (double)opsPerThread);
+}
+
+int main(int argc, char** argv) {
+  size_t maxLiveBlocks = 10000000;
+  if (argc > 1) {
+    maxLiveBlocks = strtoull(argv[1], NULL, 10);
+  }
+  size_t suiteRounds = 20000;
+  if (argc > 2) {
+    suiteRounds = strtoull(argv[2], NULL, 10);
+  }
+  PageProvider countingProvider = {countingMap, countingUnmap, countingPurge, countingRemap};
+  customSetPageProvider(&countingProvider);
+  const char* lockProfileEnv = getenv("BENCH_LOCK_PROFILE");
+  lockProfile = lockProfileEnv != NULL && atoi(lockProfileEnv) != 0;
+  customLockProfileEnable(lockProfile);
+  printf("==== bench_live_blocks ====\n");
+  for (size_t liveBlocks = 1000; liveBlocks <= maxLiveBlocks; liveBlocks *= 10) {
+    bench_live_blocks(liveBlocks, 200000);
+  }
+  printf("==== bench_fragmentation ====\n");
+  bench_fragmentation(10000, 1000000);
+  printf("==== bench_realloc_growth ====\n");
+  bench_realloc_growth(1000000);
+  printf("==== bench_slab ====\n");
+  bench_slab(10000000);
+  printf("==== bench_batch ====\n");
+  bench_batch(200000);
+  printf("==== bench_region ====\n");
+  bench_region(20000);
+  bench_suite(suiteRounds);
+  printf("==== bench_mt_scaling ====\n");
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    bench_mt_scaling(&allocators[1], threads, 200000);
+    bench_mt_scaling(&allocators[2], threads, 200000);
+  }
+  printf("==== bench_mt_ping_pong ====\n");
+  bench_mt_ping_pong(1000000);
+  // BENCH_TRACE=file records a short multi thread run for `make replay`
+  const char* tracePath = getenv("BENCH_TRACE");
+  if (tracePath != NULL) {
+    printf("==== trace ====\n");
+    if (customTraceStart(tracePath)) {
+      bench_mt_scaling(&allocators[1], 4, 50000);
+      customTraceStop();
+      printf("trace written to %s\n", tracePath);
+    } else {
+      printf("cannot write a trace to %s\n", tracePath);
+    }
+  }
+  return 0;
+}
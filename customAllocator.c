@@ -5,651 +5,2964 @@
 #include <stdbool.h>
 #include <stdio.h> //for printf
 #include <stdint.h> //for intptr_t
-#include <unistd.h> //for sbrk
+#include <unistd.h> //for sysconf
 #include <string.h> //for memset
 #include <errno.h> //for errno
-#include <stdlib.h> //for exit
-
+#include <stdlib.h> //for getenv
+#include <stdatomic.h> //for the thread cache generation
+#include <sys/mman.h> //for mmap, mremap, madvise
+#include <time.h> //for clock_gettime
+#include <fcntl.h> //for open
+
+
+// diagnostics for bad calls go to stdout; building with
+// -DCUSTOM_ALLOCATOR_ERRORS_TO_STDERR, as the preload shim does, sends them
+// to stderr, out of the output of the program the allocator runs in
+#ifdef CUSTOM_ALLOCATOR_ERRORS_TO_STDERR
+#define ALLOCATOR_ERROR(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define ALLOCATOR_ERROR(...) printf(__VA_ARGS__)
+#endif
 
 #define DEFAULT_MEMORY_AREA_SIZE (4096)
+#define DEFAULT_MEMORY_AREA_COUNT (8)
+#define DEFAULT_AREA_GROWTH_FACTOR (2)
+#define DEFAULT_MAX_MEMORY_AREA_SIZE (4 * 1024 * 1024)
+#define DEFAULT_LARGE_THRESHOLD (128 * 1024)
+#define AREA_HEADER_SIZE ALIGN_TO_MULT_OF_16(sizeof(MemoryArea)) // descriptor in front of an area's data
 
-Block* blockList = NULL; // global
-Block* lastBlock = NULL; // global 
+Segment* segmentList = NULL; // global
 MemoryArea* memoryAreaList = NULL; // global
 MemoryArea* lastMemoryArea = NULL; // global
-void* heapAtStart = NULL; // global
 pthread_mutex_t memoryAreaListMutex;
 pthread_mutex_t heapSizeModificationMutex;
 
-void freeAllMemoryFail(){
-    printf("<sbrk/brk error>: out of memory\n");
-    brk(heapAtStart);
-    exit(1);
+/*=============================================================================
+* lock profiling
+* while enabled, every profiled lock is timed from the first attempt to the
+* acquisition and from there to the last unlock of the holder. the unlock
+* side only looks at the holder's own depth, so turning profiling on or off
+* while locks are held is safe.
+=============================================================================*/
+#ifdef CUSTOM_ALLOCATOR_NO_LOCK_PROFILE
+#define LOCK_PROFILING() (false)
+#else
+static bool lockProfiling = false;
+#define LOCK_PROFILING() __atomic_load_n(&lockProfiling, __ATOMIC_RELAXED)
+#endif
+
+static LockProfile addressMapLockProfile;
+static LockProfile largeBlockListLockProfile;
+static LockProfile memoryAreaListLockProfile;
+static LockProfile heapSizeModificationLockProfile;
+
+void customLockProfileEnable(bool enable){
+#ifndef CUSTOM_ALLOCATOR_NO_LOCK_PROFILE
+    __atomic_store_n(&lockProfiling, enable, __ATOMIC_RELAXED);
+#else
+    (void)enable;
+#endif
 }
 
-void* bestFit(size_t size){
-    Block* current = blockList;
-    Block* bestBlock = NULL;
-    size_t bestSize = (size_t)(-1); // highest possible size
-    while(current != NULL){
-        if(current->free && current->size >= size && current->size < bestSize){
-            bestBlock = current;
-            bestSize = current->size;
-        }
-        current = current->next;
-    }
-    return bestBlock;
+static unsigned long long monotonicNs(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
 }
 
-void* customMalloc(size_t size){
-    size_t blockSize = ALIGN_TO_MULT_OF_4(size); // aligning only user memory
-    Block* newBlock = NULL;
-    if(blockList == NULL){ // empty heap
-        newBlock = (Block*)sbrk((intptr_t)(blockSize + sizeof(Block)));
-        if(newBlock == SBRK_FAIL){
-            if (errno == ENOMEM){
-                freeAllMemoryFail();
-            }
-            return NULL;
-        }
-        newBlock->size = blockSize;
-        newBlock->free = false;
-        newBlock->next = NULL;
-        newBlock->prev = NULL;
-        blockList = newBlock;
-        lastBlock = newBlock;
-        return (void*)(lastBlock + 1);
-    }
-
-    newBlock = bestFit(size);
-    if(newBlock != NULL){
-        newBlock->free = false;
-        return (void*)(newBlock + 1);
+// the caller holds the lock it asked for at waitStart
+static void lockProfileAcquired(LockProfile* profile, unsigned long long waitStart, bool contended){
+    unsigned long long now = monotonicNs();
+    size_t wait = (size_t)(now - waitStart);
+    size_t bucket = wait == 0 ? 0 : (size_t)(64 - __builtin_clzll((unsigned long long)wait));
+    if(bucket >= LOCK_PROFILE_BUCKETS){
+        bucket = LOCK_PROFILE_BUCKETS - 1;
     }
-
-    // need to allocate new memory in the heap
-    newBlock = (Block*)sbrk((intptr_t)(blockSize + sizeof(Block)));
-    if(newBlock == SBRK_FAIL){
-        if (errno == ENOMEM){
-            freeAllMemoryFail();
-        }
-        return NULL;
+    __atomic_fetch_add(&profile->acquisitions, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile->contended, contended ? 1 : 0, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile->waitNs, wait, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile->waitHistogram[bucket], 1, __ATOMIC_RELAXED);
+    if(profile->depth++ == 0){
+        profile->acquiredAt = now;
     }
-    newBlock->size = blockSize;
-    newBlock->free = false;
-    newBlock->next = NULL;
-    newBlock->prev = lastBlock;
-    lastBlock->next = newBlock;
-    lastBlock = newBlock;
-    return (void*)(lastBlock + 1);
 }
 
-
-static Block* findBlock(void* ptr) {
-    if (ptr == NULL) {
-        return NULL;
+// returns true when the mutex was held by another thread
+static bool profiledLock(pthread_mutex_t* mutex, LockProfile* profile){
+    unsigned long long start = LOCK_PROFILING() ? monotonicNs() : 0;
+    bool contended = pthread_mutex_trylock(mutex) != 0;
+    if(contended){
+        pthread_mutex_lock(mutex);
     }
-    Block* current = blockList;
-    while (current != NULL) {
-        void* blockUserPtr = (void*)(current + 1);
-        if (blockUserPtr == ptr) {
-            return current;
-        }
-        current = current->next;
+    if(start != 0){
+        lockProfileAcquired(profile, start, contended);
     }
-    return NULL;
+    return contended;
 }
 
-void customFree(void *ptr) {
-    if (ptr == NULL) {
-        printf("<free error>: passed null pointer\n");
-        return;
-    }
-
-    // Avoid void* comparisons
-    char *heapEnd = (char *)sbrk(0);
-    if(heapEnd == SBRK_FAIL){
-        if (errno == ENOMEM){
-            freeAllMemoryFail();
+static bool profiledTryLock(pthread_mutex_t* mutex, LockProfile* profile){
+    if(pthread_mutex_trylock(mutex) != 0){
+        if(LOCK_PROFILING()){
+            __atomic_fetch_add(&profile->contended, 1, __ATOMIC_RELAXED);
         }
-        return;
+        return false;
     }
+    if(LOCK_PROFILING()){
+        lockProfileAcquired(profile, monotonicNs(), false);
+    }
+    return true;
+}
 
-    // If blockList is NULL, allocator has no heap blocks yet
-    if (blockList == NULL) {
-        printf("<free error>: passed non-heap pointer\n");
-        return;
+static void profiledUnlock(pthread_mutex_t* mutex, LockProfile* profile){
+    if(profile->depth != 0 && --profile->depth == 0){
+        size_t hold = (size_t)(monotonicNs() - profile->acquiredAt);
+        __atomic_fetch_add(&profile->holdNs, hold, __ATOMIC_RELAXED);
+        if(hold > __atomic_load_n(&profile->maxHoldNs, __ATOMIC_RELAXED)){
+            __atomic_store_n(&profile->maxHoldNs, hold, __ATOMIC_RELAXED);
+        }
     }
+    pthread_mutex_unlock(mutex);
+}
 
-    // Minimal sanity: ptr must be below current program break
-    if ((char *)ptr >= heapEnd) {
-        printf("<free error>: passed non-heap pointer\n");
-        return;
+// keeps depth and acquiredAt, which belong to a holder that may still unlock
+static void lockProfileClear(LockProfile* profile){
+    __atomic_store_n(&profile->acquisitions, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile->contended, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile->waitNs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile->holdNs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile->maxHoldNs, 0, __ATOMIC_RELAXED);
+    for(size_t bucket = 0; bucket < LOCK_PROFILE_BUCKETS; bucket++){
+        __atomic_store_n(&profile->waitHistogram[bucket], 0, __ATOMIC_RELAXED);
     }
+}
 
-    Block *block = findBlock(ptr);
-    if (block == NULL) {
-        printf("<free error>: passed non-heap pointer\n");
-        return;
+void customLockProfileReset(){
+    lockProfileClear(&addressMapLockProfile);
+    lockProfileClear(&largeBlockListLockProfile);
+    lockProfileClear(&memoryAreaListLockProfile);
+    lockProfileClear(&heapSizeModificationLockProfile);
+    for(MemoryArea* memoryArea = __atomic_load_n(&memoryAreaList, __ATOMIC_ACQUIRE); memoryArea != NULL;
+        memoryArea = __atomic_load_n(&memoryArea->next, __ATOMIC_ACQUIRE)){
+        lockProfileClear(&memoryArea->lockProfile);
     }
+}
 
-    if (block->free) {
+static void lockProfilePrint(const char* name, LockProfile* profile){
+    size_t acquisitions = __atomic_load_n(&profile->acquisitions, __ATOMIC_RELAXED);
+    size_t contended = __atomic_load_n(&profile->contended, __ATOMIC_RELAXED);
+    if(acquisitions == 0 && contended == 0){
         return;
     }
-
-    block->free = true;
-
-    // 1) Coalesce with NEXT if free
-    if (block->next != NULL && block->next->free) {
-        Block *n = block->next;
-        block->size += sizeof(Block) + n->size;
-        block->next = n->next;
-        if (block->next != NULL) {
-            block->next->prev = block;
-        } else {
-            // merged into the last block
-            lastBlock = block;
+    size_t divisor = acquisitions == 0 ? 1 : acquisitions;
+    printf("%-24s acquired %10zu  contended %8zu  wait avg %8zu ns  hold avg %8zu ns  hold max %10zu ns\n",
+           name, acquisitions, contended,
+           __atomic_load_n(&profile->waitNs, __ATOMIC_RELAXED) / divisor,
+           __atomic_load_n(&profile->holdNs, __ATOMIC_RELAXED) / divisor,
+           __atomic_load_n(&profile->maxHoldNs, __ATOMIC_RELAXED));
+    printf("%-24s waits:", "");
+    for(size_t bucket = 0; bucket < LOCK_PROFILE_BUCKETS; bucket++){
+        size_t count = __atomic_load_n(&profile->waitHistogram[bucket], __ATOMIC_RELAXED);
+        if(count != 0){
+            printf(" <%zuns:%zu", (size_t)1 << bucket, count);
         }
     }
+    printf("\n");
+}
 
-    // 2) Coalesce with PREV if free
-    if (block->prev != NULL && block->prev->free) {
-        Block *p = block->prev;
-        p->size += sizeof(Block) + block->size;
-        p->next = block->next;
-        if (p->next != NULL) {
-            p->next->prev = p;
-        } else {
-            lastBlock = p;
-        }
-        block = p; // IMPORTANT: block is now the merged block
-    }
-
-    // 3) Return memory to OS if the (merged) block is at the end
-    if (block == lastBlock && block->free) {
-        // Detach from list first
-        if (block->prev != NULL) {
-            block->prev->next = NULL;
-            lastBlock = block->prev;
-        } else {
-            // This was the only block
-            blockList = NULL;
-            lastBlock = NULL;
-        }
-
-        // Shrink by the size of the last free block + header
-        intptr_t shrink = (intptr_t)(sizeof(Block) + block->size);
-        if (shrink > 0) {
-            if(sbrk(-shrink) == SBRK_FAIL){
-                if (errno == ENOMEM){
-                    freeAllMemoryFail();
-                }
-                return;
-            }
-        }
+void customLockProfileDump(){
+    printf("==== lock profile ====\n");
+    lockProfilePrint("addressMapMutex", &addressMapLockProfile);
+    lockProfilePrint("largeBlockListMutex", &largeBlockListLockProfile);
+    lockProfilePrint("memoryAreaListMutex", &memoryAreaListLockProfile);
+    lockProfilePrint("heapSizeModificationMutex", &heapSizeModificationLockProfile);
+    size_t index = 0;
+    for(MemoryArea* memoryArea = __atomic_load_n(&memoryAreaList, __ATOMIC_ACQUIRE); memoryArea != NULL;
+        memoryArea = __atomic_load_n(&memoryArea->next, __ATOMIC_ACQUIRE)){
+        char name[32];
+        snprintf(name, sizeof(name), "area %zu mutex", index++);
+        lockProfilePrint(name, &memoryArea->lockProfile);
     }
 }
 
-void* customCalloc(size_t nmemb, size_t size){
-    void* ptr = customMalloc(nmemb * size);
-    if(ptr == NULL){
+/*=============================================================================
+* page provider
+* the default provider hands out anonymous mappings. alignment is obtained
+* by over-mapping and trimming both ends.
+=============================================================================*/
+static void* mmapProviderMap(size_t size){
+    size_t mapSize = size + PAGE_PROVIDER_ALIGNMENT;
+    char* region = (char*)mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(region == MAP_FAILED){
         return NULL;
     }
-    memset(ptr, 0, nmemb * size);
-    return ptr;
+    char* aligned = (char*)(((uintptr_t)region + PAGE_PROVIDER_ALIGNMENT - 1) & ~(uintptr_t)(PAGE_PROVIDER_ALIGNMENT - 1));
+    if(aligned > region){
+        munmap(region, (size_t)(aligned - region));
+    }
+    char* regionEnd = region + mapSize;
+    if(regionEnd > aligned + size){
+        munmap(aligned + size, (size_t)(regionEnd - (aligned + size)));
+    }
+    return aligned;
 }
 
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
+static void mmapProviderUnmap(void* ptr, size_t size){
+    munmap(ptr, size);
+}
 
-void* customRealloc(void* ptr, size_t size){
-    if (ptr == NULL) {
-        return customMalloc(size);
-    }
+static void mmapProviderPurge(void* ptr, size_t size){
+    madvise(ptr, size, MADV_DONTNEED);
+}
 
-    // Avoid void* comparisons
-    char *heapEnd = (char *)sbrk(0);
-    if(heapEnd == SBRK_FAIL){
-        if (errno == ENOMEM){
-            freeAllMemoryFail();
-        }
-        return NULL;
+// resizes in place when the neighbouring range allows it. otherwise the
+// pages move onto a fresh aligned range, which keeps mappings on whole
+// address map units.
+static void* mmapProviderRemap(void* ptr, size_t oldSize, size_t newSize){
+    void* resized = mremap(ptr, oldSize, newSize, 0);
+    if(resized != MAP_FAILED){
+        return resized;
     }
-
-    // Minimal sanity: ptr must be below current program break
-    if ((char *)ptr >= heapEnd || (char *)ptr < (char *)blockList) {
-        printf("<realloc error>: passed non-heap pointer\n");
+    void* target = mmapProviderMap(newSize);
+    if(target == NULL){
         return NULL;
     }
-
-    Block *block = findBlock(ptr);
-    if (block == NULL) {
-        printf("<realloc error>: passed non-heap pointer\n");
+    void* moved = mremap(ptr, oldSize, newSize, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+    if(moved == MAP_FAILED){
+        munmap(target, newSize);
         return NULL;
     }
+    return moved;
+}
+
+static const PageProvider mmapPageProvider = {
+    mmapProviderMap, mmapProviderUnmap, mmapProviderPurge, mmapProviderRemap
+};
+static PageProvider pageProvider = {
+    mmapProviderMap, mmapProviderUnmap, mmapProviderPurge, mmapProviderRemap
+};
+
+void customSetPageProvider(const PageProvider* provider){
+    pageProvider = provider != NULL ? *provider : mmapPageProvider;
+}
+
+// threads may race to fill the cache; they all store the same value
+static size_t pageSize(){
+    static size_t cachedPageSize = 0;
+    size_t size = __atomic_load_n(&cachedPageSize, __ATOMIC_RELAXED);
     if(size == 0){
-        customFree(ptr);
-        return NULL;
+        size = (size_t)sysconf(_SC_PAGESIZE);
+        __atomic_store_n(&cachedPageSize, size, __ATOMIC_RELAXED);
     }
+    return size;
+}
 
-    size_t oldSize = block->size;
-    if (size <= oldSize) {
-        if(block == lastBlock){
-            size_t newSize = ALIGN_TO_MULT_OF_4(size);
-            if(newSize == oldSize){
-                return ptr;
-            }
-            if(sbrk(newSize - oldSize) == SBRK_FAIL){
-                if (errno == ENOMEM){
-                    freeAllMemoryFail();
-                }
-                return NULL;
-            }
-            lastBlock->size = newSize;
-            return ptr;
+/*=============================================================================
+* tracing
+* while a trace is on, the public entry points log each call into a buffer
+* private to the calling thread. a full buffer is appended to the file under
+* traceMutex, so the file holds runs of each thread's records in turn and
+* the timestamps give the order. frees are stamped before the call and
+* allocations after it, so a block freed by one thread and reused by another
+* is freed first in time. a realloc does both, so it logs a record for each
+* end of the call. calls the allocator makes itself, like
+* customRealloc moving a block, are not logged.
+=============================================================================*/
+#define TRACE_BUFFER_BYTES (4 * PAGE_PROVIDER_ALIGNMENT)
+#define TRACE_BUFFER_RECORDS (TRACE_BUFFER_BYTES / sizeof(TraceRecord))
+
+typedef struct ThreadTrace
+{
+    TraceRecord* records; // mapped from the page provider, kept until the thread exits
+    size_t count;
+    unsigned int thread;
+    bool busy; // inside a logged call, whose nested calls are not logged
+    bool linked; // on threadTraceList
+    struct ThreadTrace* next;
+    struct ThreadTrace* prev;
+} ThreadTrace;
+
+static _Thread_local ThreadTrace threadTrace;
+static bool tracing = false;
+static int traceFd = -1;
+static unsigned int nextTraceThread = 0;
+static ThreadTrace* threadTraceList = NULL;
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t threadTraceKey;
+static pthread_once_t threadTraceKeyOnce = PTHREAD_ONCE_INIT;
+
+// one load while no trace is on
+#define TRACING() (__atomic_load_n(&tracing, __ATOMIC_RELAXED) && !threadTrace.busy)
+
+// appends the buffer to the file, dropping it if there is none; traceMutex
+// must be held
+static void traceFlush(ThreadTrace* trace){
+    const char* data = (const char*)trace->records;
+    size_t bytes = trace->count * sizeof(TraceRecord);
+    while(traceFd >= 0 && bytes > 0){
+        ssize_t written = write(traceFd, data, bytes);
+        if(written < 0 && errno == EINTR){
+            continue;
         }
-        void* newPtr = customMalloc(size);
-        if(newPtr == NULL){
-            return NULL;
+        if(written <= 0){
+            break;
         }
-        memcpy(newPtr, ptr, size);
-        customFree(ptr);
-        return newPtr;
+        data += written;
+        bytes -= (size_t)written;
     }
-    else { // size > oldSize
-        if(block == lastBlock){
-            size_t newSize = ALIGN_TO_MULT_OF_4(size);
-            if(newSize == oldSize){
-                return ptr;
-            }
-            if(sbrk(newSize - oldSize) == SBRK_FAIL){
-                if (errno == ENOMEM){
-                    freeAllMemoryFail();
-                }
-                return NULL;
-            }
-            lastBlock->size = newSize;
-            return ptr;
-        }
-        void* newPtr = customMalloc(size);
-        if(newPtr == NULL){
+    trace->count = 0;
+}
+
+// pthread key destructor - writes out the exiting thread's records
+static void threadTraceDestroy(void* arg){
+    ThreadTrace* trace = (ThreadTrace*)arg;
+    pthread_mutex_lock(&traceMutex);
+    traceFlush(trace);
+    if(trace->prev != NULL){
+        trace->prev->next = trace->next;
+    }else{
+        threadTraceList = trace->next;
+    }
+    if(trace->next != NULL){
+        trace->next->prev = trace->prev;
+    }
+    trace->linked = false;
+    pthread_mutex_unlock(&traceMutex);
+    pageProvider.unmap(trace->records, TRACE_BUFFER_BYTES);
+    trace->records = NULL;
+}
+
+static void threadTraceKeyCreate(){
+    pthread_key_create(&threadTraceKey, threadTraceDestroy);
+}
+
+static ThreadTrace* getThreadTrace(){
+    ThreadTrace* trace = &threadTrace;
+    if(!trace->linked){
+        trace->records = (TraceRecord*)pageProvider.map(TRACE_BUFFER_BYTES);
+        if(trace->records == NULL){
             return NULL;
         }
-        memcpy(newPtr, ptr, oldSize);
-        customFree(ptr);
-        return newPtr;
+        trace->count = 0;
+        pthread_once(&threadTraceKeyOnce, threadTraceKeyCreate);
+        pthread_mutex_lock(&traceMutex);
+        trace->thread = nextTraceThread++;
+        trace->prev = NULL;
+        trace->next = threadTraceList;
+        if(threadTraceList != NULL){
+            threadTraceList->prev = trace;
+        }
+        threadTraceList = trace;
+        trace->linked = true;
+        pthread_mutex_unlock(&traceMutex);
+        pthread_setspecific(threadTraceKey, trace);
     }
+    return trace;
 }
 
-void freeMemoryArea(MemoryArea* memoryArea){
-    // free the block list
-    pthread_mutex_lock(&memoryArea->mutex);
-    BlockMT* current = memoryArea->blockList;
-    while(current != NULL){
-        BlockMT* next = current->next;
-        customFree(current);
-        current = next;
+static void traceRecord(TraceOp op, unsigned long long time, size_t size, const void* ptr, uintptr_t arg){
+    ThreadTrace* trace = getThreadTrace();
+    if(trace == NULL){
+        return;
+    }
+    TraceRecord* record = &trace->records[trace->count++];
+    record->time = time;
+    record->size = size;
+    record->ptr = (uintptr_t)ptr;
+    record->arg = arg;
+    record->thread = trace->thread;
+    record->op = op;
+    if(trace->count == TRACE_BUFFER_RECORDS){
+        pthread_mutex_lock(&traceMutex);
+        traceFlush(trace);
+        pthread_mutex_unlock(&traceMutex);
     }
-    pthread_mutex_unlock(&memoryArea->mutex);
-    pthread_mutex_destroy(&memoryArea->mutex);
-    // free the memory area
-    customFree(memoryArea->dataPtr);
-    customFree(memoryArea);
 }
 
-void freeMemoryAreaList(){
-    MemoryArea* current = memoryAreaList;
-    while(current != NULL){
-        MemoryArea* next = current->next;
-        freeMemoryArea(current);
-        current = next;
+// a logged call is bracketed by traceBegin and traceAllocated, traceFreed or
+// traceReallocated. a pointer given back is stamped with the time the call
+// began, since another thread may have the address before it returns; a
+// pointer handed out is stamped with the time it returned
+static inline unsigned long long traceBegin(){
+    threadTrace.busy = true;
+    return monotonicNs();
+}
+
+static inline void traceAllocated(TraceOp op, size_t size, const void* ptr, uintptr_t arg){
+    threadTrace.busy = false;
+    traceRecord(op, monotonicNs(), size, ptr, arg);
+}
+
+static inline void traceFreed(TraceOp op, unsigned long long time, const void* ptr){
+    threadTrace.busy = false;
+    traceRecord(op, time, 0, ptr, 0);
+}
+
+static inline void traceReallocated(TraceOp op, TraceOp returnOp, unsigned long long time, size_t size, const void* ptr, const void* oldPtr){
+    threadTrace.busy = false;
+    traceRecord(op, time, size, ptr, (uintptr_t)oldPtr);
+    traceRecord(returnOp, monotonicNs(), size, ptr, (uintptr_t)oldPtr);
+}
+
+bool customTraceStart(const char* path){
+    pthread_mutex_lock(&traceMutex);
+    if(traceFd >= 0){
+        pthread_mutex_unlock(&traceMutex);
+        return false;
     }
-    memoryAreaList = NULL;
-    lastMemoryArea = NULL;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        pthread_mutex_unlock(&traceMutex);
+        return false;
+    }
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(TraceFileHeader));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    if(write(fd, &header, sizeof(TraceFileHeader)) != (ssize_t)sizeof(TraceFileHeader)){
+        close(fd);
+        pthread_mutex_unlock(&traceMutex);
+        return false;
+    }
+    // records left over from an earlier trace are not part of this one
+    for(ThreadTrace* trace = threadTraceList; trace != NULL; trace = trace->next){
+        trace->count = 0;
+    }
+    traceFd = fd;
+    pthread_mutex_unlock(&traceMutex);
+    __atomic_store_n(&tracing, true, __ATOMIC_RELEASE);
+    return true;
 }
 
+void customTraceStop(){
+    __atomic_store_n(&tracing, false, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&traceMutex);
+    for(ThreadTrace* trace = threadTraceList; trace != NULL; trace = trace->next){
+        traceFlush(trace);
+    }
+    if(traceFd >= 0){
+        close(traceFd);
+        traceFd = -1;
+    }
+    pthread_mutex_unlock(&traceMutex);
+}
 
-MemoryArea* createMemoryArea(size_t size){
-    // locking before function call
-    MemoryArea* newMemoryArea = (MemoryArea*)customMalloc(sizeof(MemoryArea));
-    if(newMemoryArea == NULL){
-        return NULL;
+/*=============================================================================
+* address map
+* two level radix table from each PAGE_PROVIDER_ALIGNMENT sized unit of the
+* address space to the mapping owning it: a Part A segment, an MT area, a
+* large block or a slab chunk, told apart by the low bits of the entry. lookups take no lock;
+* leaves are created on demand and never freed.
+=============================================================================*/
+#define ADDRESS_MAP_UNIT_SHIFT (16) // log2(PAGE_PROVIDER_ALIGNMENT)
+#define ADDRESS_MAP_LEAF_BITS (16)
+#define ADDRESS_MAP_ROOT_BITS (48 - ADDRESS_MAP_UNIT_SHIFT - ADDRESS_MAP_LEAF_BITS)
+#define ADDRESS_MAP_SEGMENT ((uintptr_t)0)
+#define ADDRESS_MAP_AREA ((uintptr_t)1)
+#define ADDRESS_MAP_LARGE ((uintptr_t)2)
+#define ADDRESS_MAP_SLAB ((uintptr_t)3)
+#define ADDRESS_MAP_KIND_MASK ((uintptr_t)7)
+
+typedef struct AddressMapLeaf
+{
+    _Atomic uintptr_t entries[1 << ADDRESS_MAP_LEAF_BITS];
+} AddressMapLeaf;
+
+static AddressMapLeaf* _Atomic addressMapRoot[1 << ADDRESS_MAP_ROOT_BITS];
+static pthread_mutex_t addressMapMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uintptr_t addressMapGet(const void* ptr){
+    uintptr_t unit = (uintptr_t)ptr >> ADDRESS_MAP_UNIT_SHIFT;
+    if((unit >> (ADDRESS_MAP_ROOT_BITS + ADDRESS_MAP_LEAF_BITS)) != 0){
+        return 0;
     }
-    // Initialize the area's data
-    newMemoryArea->dataPtr = (void*)customMalloc(size);
-    if(newMemoryArea->dataPtr == NULL){
-        customFree(newMemoryArea);
-        return NULL;
+    AddressMapLeaf* leaf = atomic_load_explicit(&addressMapRoot[unit >> ADDRESS_MAP_LEAF_BITS], memory_order_acquire);
+    if(leaf == NULL){
+        return 0;
     }
-    // Initialize the area's block list
-    newMemoryArea->blockList = (BlockMT*)customMalloc(sizeof(BlockMT));
-    if(newMemoryArea->blockList == NULL){
-        customFree(newMemoryArea->dataPtr);
-        customFree(newMemoryArea);
+    return atomic_load_explicit(&leaf->entries[unit & ((1 << ADDRESS_MAP_LEAF_BITS) - 1)], memory_order_acquire);
+}
+
+// the owner of ptr if it is of the given kind, NULL otherwise
+static inline void* addressMapFind(const void* ptr, uintptr_t kind){
+    uintptr_t owner = addressMapGet(ptr);
+    if(owner == 0 || (owner & ADDRESS_MAP_KIND_MASK) != kind){
         return NULL;
     }
-    newMemoryArea->blockList->size = size;
-    newMemoryArea->blockList->free = true;
-    newMemoryArea->blockList->next = NULL;
-    newMemoryArea->blockList->prev = NULL;
-    newMemoryArea->blockList->dataPtr = newMemoryArea->dataPtr;
+    return (void*)(owner & ~ADDRESS_MAP_KIND_MASK);
+}
 
-    newMemoryArea->size = size;
+// points every unit of [start, start + size) at owner (0 clears). fails only
+// when a leaf cannot be mapped, leaving the range unregistered.
+static bool addressMapSet(const void* start, size_t size, uintptr_t owner){
+    uintptr_t first = (uintptr_t)start >> ADDRESS_MAP_UNIT_SHIFT;
+    uintptr_t last = ((uintptr_t)start + size - 1) >> ADDRESS_MAP_UNIT_SHIFT;
+    if((last >> (ADDRESS_MAP_ROOT_BITS + ADDRESS_MAP_LEAF_BITS)) != 0){
+        return false;
+    }
+    profiledLock(&addressMapMutex, &addressMapLockProfile);
+    for(uintptr_t unit = first; unit <= last; unit++){
+        size_t rootIndex = unit >> ADDRESS_MAP_LEAF_BITS;
+        AddressMapLeaf* leaf = atomic_load_explicit(&addressMapRoot[rootIndex], memory_order_relaxed);
+        if(leaf == NULL){
+            if(owner == 0){
+                continue;
+            }
+            leaf = (AddressMapLeaf*)pageProvider.map(sizeof(AddressMapLeaf));
+            if(leaf == NULL){
+                for(uintptr_t undo = first; undo < unit; undo++){
+                    AddressMapLeaf* undoLeaf = atomic_load_explicit(&addressMapRoot[undo >> ADDRESS_MAP_LEAF_BITS], memory_order_relaxed);
+                    atomic_store(&undoLeaf->entries[undo & ((1 << ADDRESS_MAP_LEAF_BITS) - 1)], 0);
+                }
+                profiledUnlock(&addressMapMutex, &addressMapLockProfile);
+                return false;
+            }
+            atomic_store_explicit(&addressMapRoot[rootIndex], leaf, memory_order_release);
+        }
+        atomic_store_explicit(&leaf->entries[unit & ((1 << ADDRESS_MAP_LEAF_BITS) - 1)], owner, memory_order_release);
+    }
+    profiledUnlock(&addressMapMutex, &addressMapLockProfile);
+    return true;
+}
 
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&newMemoryArea->mutex, &attr);
-    pthread_mutexattr_destroy(&attr);
+/*=============================================================================
+* block format
+* allocated: [header | payload ..................................]
+* free:      [header | nextFree | prevFree | ........... | footer]
+* header = address tag (bits 48-63) | block size incl. header | flags.
+* the footer is a copy of the header, valid only while the block is free; the
+* next block's BLOCK_PREV_FREE bit says when it may be read. every segment
+* ends with an allocated zero-size epilogue header.
+* BLOCK_ZERO marks a free block carved from a fresh segment and never handed
+* out since: everything but its links and footer is still zero.
+=============================================================================*/
+#define BLOCK_HEADER_SIZE (sizeof(size_t))
+#define MIN_BLOCK_SIZE (sizeof(Block) + sizeof(size_t)) // links + footer
+#define BLOCK_FREE ((size_t)1)
+#define BLOCK_PREV_FREE ((size_t)2)
+#define BLOCK_ZERO ((size_t)4)
+#define BLOCK_FLAGS (BLOCK_FREE | BLOCK_PREV_FREE | BLOCK_ZERO)
+#define BLOCK_SIZE_MASK (((((size_t)1) << 48) - 1) & ~(size_t)15) // sizes are multiples of 16
+#define BLOCK_TAG_MASK (~((((size_t)1) << 48) - 1))
+#define BLOCK_TAG(block) (((size_t)(uintptr_t)(block) * 0x9E3779B97F4A7C15ULL) & BLOCK_TAG_MASK)
+
+#define BLOCK_TO_PTR(block) ((void*)((char*)(block) + BLOCK_HEADER_SIZE))
+#define PTR_TO_BLOCK(ptr) ((Block*)((char*)(ptr) - BLOCK_HEADER_SIZE))
+
+static inline size_t blockGetSize(Block* block){
+    return block->header & BLOCK_SIZE_MASK;
+}
 
-    newMemoryArea->next = NULL;
+static inline bool blockIsFree(Block* block){
+    return (block->header & BLOCK_FREE) != 0;
+}
 
-    return newMemoryArea;
+static inline void blockSetHeader(Block* block, size_t size, size_t flags){
+    block->header = BLOCK_TAG(block) | size | flags;
 }
 
-void heapCreate(){
-    heapAtStart = sbrk(0);
-    if(heapAtStart == SBRK_FAIL){
-        exit(1);
-    }
-    pthread_mutex_init(&heapSizeModificationMutex, NULL);
+static inline Block* blockNext(Block* block){
+    return (Block*)((char*)block + blockGetSize(block));
+}
 
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&memoryAreaListMutex, &attr);
-    pthread_mutexattr_destroy(&attr);
+// only valid when the caller checked BLOCK_PREV_FREE
+static inline Block* blockPrev(Block* block){
+    size_t prevFooter = *((size_t*)block - 1);
+    return (Block*)((char*)block - (prevFooter & BLOCK_SIZE_MASK));
+}
 
-    pthread_mutex_lock(&memoryAreaListMutex);
+static inline void blockWriteFooter(Block* block){
+    *((size_t*)blockNext(block) - 1) = block->header;
+}
 
-    for (int i = 0; i < 8; i++){
-        MemoryArea* newMemoryArea = createMemoryArea(DEFAULT_MEMORY_AREA_SIZE);
-        if(newMemoryArea == NULL){
-            freeMemoryAreaList();
-            pthread_mutex_unlock(&memoryAreaListMutex);
-            return;
-        }
+// block size (header included) needed to hand out `size` user bytes
+// block sizes are multiples of MALLOC_ALIGNMENT and every segment's first
+// header sits 8 bytes short of an aligned address, so all payloads are aligned
+static inline size_t blockSizeFor(size_t size){
+    size_t blockSize = ALIGN_TO_MULT_OF_16(size + BLOCK_HEADER_SIZE);
+    return blockSize < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : blockSize;
+}
 
-        if(memoryAreaList == NULL){
-            memoryAreaList = newMemoryArea;
-        }else{
-            lastMemoryArea->next = newMemoryArea;
-        }
-        lastMemoryArea = newMemoryArea;
+/*=============================================================================
+* size class free lists
+* exact classes for every block size up to SMALL_SIZE_CLASS_LIMIT, then one
+* class per power-of-two range. only free blocks are linked in the lists.
+* a bitmap of the non-empty classes, one per heap and one per area, finds
+* the first class that can serve a request with a count of trailing zeros
+* per 64 classes instead of a look at every list head.
+=============================================================================*/
+#define SMALL_SIZE_CLASS_LIMIT (256)
+#define NUM_SMALL_SIZE_CLASSES (SMALL_SIZE_CLASS_LIMIT / 8)
+#define NUM_SIZE_CLASSES (NUM_SMALL_SIZE_CLASSES + 64 - 8)
+#define FREE_LIST_SCAN_LIMIT (8) // good-fit: candidates checked per class
+#define SIZE_CLASS_BITMAP_WORDS ((NUM_SIZE_CLASSES + 63) / 64)
+
+Block* freeLists[NUM_SIZE_CLASSES] = {NULL}; // global
+static unsigned long long freeListBitmap[SIZE_CLASS_BITMAP_WORDS]; // non-empty classes
+static size_t freeBytes = 0; // sizes of the blocks in freeLists
+static size_t freeBlockCount = 0;
+
+static size_t sizeClass(size_t size){
+    // size is a block size, a multiple of 16
+    if(size <= SMALL_SIZE_CLASS_LIMIT){
+        return size == 0 ? 0 : (size >> 3) - 1;
     }
+    size_t log2Size = (size_t)(63 - __builtin_clzll((unsigned long long)size));
+    return NUM_SMALL_SIZE_CLASSES + log2Size - 8;
+}
 
-    pthread_mutex_unlock(&memoryAreaListMutex);
+// every block of an exact class has the class's size
+static inline bool isExactClass(size_t cls){
+    return cls < NUM_SMALL_SIZE_CLASSES;
 }
 
-void heapKill(){
-    pthread_mutex_lock(&memoryAreaListMutex);
-    if(memoryAreaList == NULL){
-        pthread_mutex_unlock(&memoryAreaListMutex);
-        return;
-    }
-    freeMemoryAreaList();
-    pthread_mutex_unlock(&memoryAreaListMutex);
+static inline void classBitmapSet(unsigned long long* bitmap, size_t cls){
+    bitmap[cls / 64] |= 1ULL << (cls % 64);
+}
 
-    pthread_mutex_destroy(&memoryAreaListMutex);
-    pthread_mutex_destroy(&heapSizeModificationMutex);
+static inline void classBitmapClear(unsigned long long* bitmap, size_t cls){
+    bitmap[cls / 64] &= ~(1ULL << (cls % 64));
 }
 
-BlockMT* bestFitMT(MemoryArea* memoryArea, size_t size){
-    BlockMT* bestBlock = NULL;
-    size_t bestSize = (size_t)(-1); // highest possible size
-    BlockMT* current = memoryArea->blockList;
-    while(current != NULL){
-        if(current->free && current->size >= size && current->size < bestSize){
-            bestBlock = current;
-            bestSize = current->size;
+// first non-empty class at or above cls, NUM_SIZE_CLASSES if there is none.
+// __builtin_ctzll is emitted as tzcnt, which CPUs without BMI1 run as bsf;
+// the two agree for the non-zero words it is given, so there is nothing to
+// select at runtime
+static size_t firstSetClass(const unsigned long long* bitmap, size_t cls){
+    if(cls >= NUM_SIZE_CLASSES){
+        return NUM_SIZE_CLASSES;
+    }
+    size_t word = cls / 64;
+    unsigned long long bits = bitmap[word] & (~0ULL << (cls % 64));
+    while(bits == 0){
+        if(++word == SIZE_CLASS_BITMAP_WORDS){
+            return NUM_SIZE_CLASSES;
         }
-        current = current->next;
+        bits = bitmap[word];
     }
-    return bestBlock;
+    return word * 64 + (size_t)__builtin_ctzll(bits);
 }
 
-void* customMTMalloc(size_t size){
-    if(size > DEFAULT_MEMORY_AREA_SIZE){
-        printf("<malloc error>: requested size is too large\n");
-        return NULL;
-    }
-    pthread_mutex_lock(&memoryAreaListMutex);
-    if(memoryAreaList == NULL){
-        pthread_mutex_unlock(&memoryAreaListMutex);
-        return NULL;
+static void insertFreeBlock(Block* block){
+    size_t cls = sizeClass(blockGetSize(block));
+    block->prevFree = NULL;
+    block->nextFree = freeLists[cls];
+    if(freeLists[cls] != NULL){
+        freeLists[cls]->prevFree = block;
     }
+    freeLists[cls] = block;
+    classBitmapSet(freeListBitmap, cls);
+    freeBytes += blockGetSize(block);
+    freeBlockCount++;
+}
 
-    BlockMT* bestBlock = NULL;
-    MemoryArea* chosenMemoryArea = NULL;
-    bool queueHeadHasNoSpace = false;
-    while(memoryAreaList != NULL){
-        pthread_mutex_lock(&memoryAreaList->mutex);
-        bestBlock = bestFitMT(memoryAreaList, size);
-        pthread_mutex_unlock(&memoryAreaList->mutex);
-        if(bestBlock == NULL && !queueHeadHasNoSpace){
-            // Add a new memory area to the list
-            pthread_mutex_lock(&heapSizeModificationMutex);
-            lastMemoryArea->next = createMemoryArea(DEFAULT_MEMORY_AREA_SIZE);
-            pthread_mutex_unlock(&heapSizeModificationMutex);
-            if(lastMemoryArea->next == NULL){
-                pthread_mutex_unlock(&memoryAreaListMutex);
-                return NULL;
-            }
-            lastMemoryArea = lastMemoryArea->next;
-            queueHeadHasNoSpace = true;
-        }
-        chosenMemoryArea = memoryAreaList;
-        
-        // Rotate the memory area list (putting first area last)
-        lastMemoryArea->next = memoryAreaList;
-        lastMemoryArea = lastMemoryArea->next;
-        memoryAreaList = memoryAreaList->next;
-        lastMemoryArea->next = NULL;
-
-        if (bestBlock != NULL){
-            break;
+static void removeFreeBlock(Block* block){
+    if(block->prevFree != NULL){
+        block->prevFree->nextFree = block->nextFree;
+    }else{
+        size_t cls = sizeClass(blockGetSize(block));
+        freeLists[cls] = block->nextFree;
+        if(block->nextFree == NULL){
+            classBitmapClear(freeListBitmap, cls);
         }
     }
-    pthread_mutex_lock(&chosenMemoryArea->mutex);
-    pthread_mutex_unlock(&memoryAreaListMutex);
+    if(block->nextFree != NULL){
+        block->nextFree->prevFree = block->prevFree;
+    }
+    freeBytes -= blockGetSize(block);
+    freeBlockCount--;
+}
 
-    size_t newBlockSize = bestBlock->size - ALIGN_TO_MULT_OF_4(size);
-    bestBlock->free = false;
-    if(newBlockSize > 0){
-        // split the block into two blocks
-        pthread_mutex_lock(&heapSizeModificationMutex);
-        BlockMT* newBlock = (BlockMT*)customMalloc(sizeof(BlockMT));
-        pthread_mutex_unlock(&heapSizeModificationMutex);
-        if(newBlock == NULL){
-            pthread_mutex_unlock(&chosenMemoryArea->mutex);
-            return NULL;
+// marks the block free, writes its footer and links it in its size class.
+// BLOCK_ZERO is kept when the caller set it
+static void releaseToFreeList(Block* block, size_t size){
+    blockSetHeader(block, size, BLOCK_FREE | (block->header & (BLOCK_PREV_FREE | BLOCK_ZERO)));
+    blockWriteFooter(block);
+    Block* next = blockNext(block);
+    next->header |= BLOCK_PREV_FREE;
+    insertFreeBlock(block);
+}
+
+void* bestFit(size_t size){
+    size_t blockSize = blockSizeFor(size);
+    size_t cls = sizeClass(blockSize);
+    if(isExactClass(cls) && freeLists[cls] != NULL){
+        return freeLists[cls];
+    }
+    for(cls = firstSetClass(freeListBitmap, cls); cls < NUM_SIZE_CLASSES; cls = firstSetClass(freeListBitmap, cls + 1)){
+        // every block in a higher class fits, so the first class with a
+        // block that fits is the only one that needs to be searched
+        Block* current = freeLists[cls];
+        Block* bestBlock = NULL;
+        size_t bestSize = (size_t)(-1); // highest possible size
+        for(int i = 0; current != NULL && i < FREE_LIST_SCAN_LIMIT; i++){
+            size_t currentSize = blockGetSize(current);
+            if(currentSize >= blockSize && currentSize < bestSize){
+                bestBlock = current;
+                bestSize = currentSize;
+                if(currentSize == blockSize){
+                    break;
+                }
+            }
+            current = current->nextFree;
         }
-        bestBlock->size = ALIGN_TO_MULT_OF_4(size);
+        if(bestBlock != NULL){
+            return bestBlock;
+        }
+    }
+    return NULL;
+}
 
-        newBlock->size = newBlockSize;
-        newBlock->dataPtr = (void*)((char*)bestBlock->dataPtr + bestBlock->size);
-        newBlock->free = true;
+/*=============================================================================
+* segments
+* the heap is a list of segments from the page provider. a segment whose
+* blocks are all free goes back to the provider (except the last one), and
+* every PURGE_INTERVAL freed bytes the pages inside large free blocks are
+* purged.
+=============================================================================*/
+#define SEGMENT_SIZE (1024 * 1024)
+#define PURGE_THRESHOLD (64 * 1024) // smallest free block whose pages get purged
+#define PURGE_INTERVAL (4 * 1024 * 1024) // bytes freed between purge sweeps
+#define FRESH_CALLOC_THRESHOLD (128 * 1024) // callocs from here up get a segment of their own
+
+static size_t bytesFreedSincePurge = 0;
+static size_t heapBytes = 0; // mapped for segments
+static size_t peakHeapBytes = 0;
+static size_t allocatedBlockCount = 0;
+
+static inline Block* segmentFirstBlock(Segment* segment){
+    return (Block*)(segment + 1);
+}
 
-        newBlock->prev = bestBlock;
-        newBlock->next = bestBlock->next;
-        bestBlock->next = newBlock;
+static inline Block* segmentEpilogue(Segment* segment){
+    return (Block*)((char*)segment + segment->size - BLOCK_HEADER_SIZE);
+}
 
-        if (newBlock->next != NULL){
-            newBlock->next->prev = newBlock;
-        }
+// maps a segment of at least minSize bytes that can hold blockSize; all of
+// it becomes one free block, which is returned
+static Block* createSegment(size_t blockSize, size_t minSize){
+    size_t overhead = sizeof(Segment) + BLOCK_HEADER_SIZE;
+    if(blockSize > BLOCK_SIZE_MASK - overhead - PAGE_PROVIDER_ALIGNMENT){
+        return NULL;
+    }
+    size_t size = (blockSize + overhead + PAGE_PROVIDER_ALIGNMENT - 1) & ~(size_t)(PAGE_PROVIDER_ALIGNMENT - 1);
+    if(size < minSize){
+        size = minSize;
+    }
+    Segment* segment = (Segment*)pageProvider.map(size);
+    if(segment == NULL){
+        return NULL;
+    }
+    if(!addressMapSet(segment, size, (uintptr_t)segment | ADDRESS_MAP_SEGMENT)){
+        pageProvider.unmap(segment, size);
+        return NULL;
+    }
+    segment->size = size;
+    segment->prev = NULL;
+    segment->next = segmentList;
+    if(segmentList != NULL){
+        segmentList->prev = segment;
+    }
+    segmentList = segment;
+    heapBytes += size;
+    if(heapBytes > peakHeapBytes){
+        peakHeapBytes = heapBytes;
     }
 
-    pthread_mutex_unlock(&chosenMemoryArea->mutex);
-    return (void*)(bestBlock->dataPtr);
+    Block* block = segmentFirstBlock(segment);
+    Block* epilogue = segmentEpilogue(segment);
+    blockSetHeader(epilogue, 0, 0);
+    // the provider's pages start out zeroed
+    blockSetHeader(block, (size_t)((char*)epilogue - (char*)block), BLOCK_ZERO);
+    releaseToFreeList(block, blockGetSize(block));
+    return block;
 }
 
-MemoryArea* findMemoryArea(void* ptr){
-    MemoryArea* current = memoryAreaList;
-    while(current != NULL){
-        if(ptr >= current->dataPtr && ptr < (void*)((char*)current->dataPtr + current->size)){
-            return current;
-        }
-        current = current->next;
+static void releaseSegment(Segment* segment){
+    if(segment->prev != NULL){
+        segment->prev->next = segment->next;
+    }else{
+        segmentList = segment->next;
     }
-    return NULL;
+    if(segment->next != NULL){
+        segment->next->prev = segment->prev;
+    }
+    heapBytes -= segment->size;
+    addressMapSet(segment, segment->size, 0);
+    pageProvider.unmap(segment, segment->size);
 }
 
-BlockMT* findBlockMT(MemoryArea* memoryArea, void* ptr){
-    BlockMT* current = memoryArea->blockList;
-    while(current != NULL){
-        if(current->dataPtr == ptr){
-            return current;
+// hands the pages inside large free blocks back to the OS. the block header,
+// its links and its footer stay resident, so the blocks stay usable.
+static void purgeFreeBlocks(){
+    size_t page = pageSize();
+    for(size_t cls = sizeClass(PURGE_THRESHOLD); cls < NUM_SIZE_CLASSES; cls++){
+        for(Block* current = freeLists[cls]; current != NULL; current = current->nextFree){
+            size_t size = blockGetSize(current);
+            if(size < PURGE_THRESHOLD){
+                continue;
+            }
+            uintptr_t start = ((uintptr_t)(current + 1) + page - 1) & ~(uintptr_t)(page - 1);
+            uintptr_t end = ((uintptr_t)current + size - sizeof(size_t)) & ~(uintptr_t)(page - 1);
+            if(end > start){
+                pageProvider.purge((void*)start, (size_t)(end - start));
+            }
         }
-        current = current->next;
     }
-    return NULL;
 }
 
-void customMTFree(void* ptr){
-    if(ptr == NULL){
-        printf("<free error>: passed null pointer\n");
-        return;
+// takes a block off its free list and hands out its first blockSize bytes,
+// splitting off the remainder when it can hold a block of its own. the block
+// keeps BLOCK_ZERO for the caller to read and clear
+static Block* takeFreeBlock(Block* block, size_t blockSize){
+    removeFreeBlock(block);
+    allocatedBlockCount++;
+    size_t freeSize = blockGetSize(block);
+    size_t zero = block->header & BLOCK_ZERO;
+    if(freeSize - blockSize >= MIN_BLOCK_SIZE){
+        // split: hand out the front, the remainder goes back to the lists.
+        // the remainder lies past the front's links, so it is as zero as
+        // the whole block was
+        blockSetHeader(block, blockSize, block->header & (BLOCK_PREV_FREE | BLOCK_ZERO));
+        Block* remainder = blockNext(block);
+        remainder->header = zero;
+        releaseToFreeList(remainder, freeSize - blockSize);
+        return block;
     }
+    blockSetHeader(block, freeSize, block->header & (BLOCK_PREV_FREE | BLOCK_ZERO));
+    blockNext(block)->header &= ~BLOCK_PREV_FREE;
+    return block;
+}
 
-    pthread_mutex_lock(&memoryAreaListMutex);
-    if(memoryAreaList == NULL){
-        printf("<free error>: passed non-heap pointer\n");
-        pthread_mutex_unlock(&memoryAreaListMutex);
-        return;
+void* customMalloc(size_t size){
+    if(TRACING()){
+        traceBegin();
+        void* ptr = customMalloc(size);
+        traceAllocated(TRACE_MALLOC, size, ptr, 0);
+        return ptr;
     }
-    MemoryArea* memoryArea = findMemoryArea(ptr);
-    if(memoryArea == NULL){
-        printf("<free error>: passed non-heap pointer\n");
-        pthread_mutex_unlock(&memoryAreaListMutex);
-        return;
+    if(size > BLOCK_SIZE_MASK - MIN_BLOCK_SIZE){
+        return NULL;
     }
-    pthread_mutex_lock(&memoryArea->mutex);
-    pthread_mutex_unlock(&memoryAreaListMutex);
+    size_t blockSize = blockSizeFor(size);
+    Block* newBlock = bestFit(size);
+    if(newBlock == NULL){
+        // need to map more memory
+        newBlock = createSegment(blockSize, SEGMENT_SIZE);
+        if(newBlock == NULL){
+            return NULL;
+        }
+    }
+    newBlock = takeFreeBlock(newBlock, blockSize);
+    newBlock->header &= ~BLOCK_ZERO;
+    return BLOCK_TO_PTR(newBlock);
+}
+
+// O(1): the address map gives the segment, the header sits right before the
+// user pointer. the pointer is only trusted if the header carries the tag of
+// its own address.
+static Block* findBlock(void* ptr) {
+    if (ptr == NULL || ((uintptr_t)ptr & 7) != 0) {
+        return NULL;
+    }
+    Segment* segment = (Segment*)addressMapFind(ptr, ADDRESS_MAP_SEGMENT);
+    if (segment == NULL) {
+        return NULL;
+    }
+    Block* epilogue = segmentEpilogue(segment);
+    if ((char*)ptr < (char*)BLOCK_TO_PTR(segmentFirstBlock(segment)) || (char*)ptr > (char*)epilogue) {
+        return NULL;
+    }
+    Block* block = PTR_TO_BLOCK(ptr);
+    if ((block->header & BLOCK_TAG_MASK) != BLOCK_TAG(block)) {
+        return NULL;
+    }
+    size_t size = blockGetSize(block);
+    if (size < MIN_BLOCK_SIZE || (char*)block + size > (char*)epilogue) {
+        return NULL;
+    }
+    return block;
+}
+
+void customFree(void *ptr) {
+    if (TRACING()) {
+        unsigned long long time = traceBegin();
+        customFree(ptr);
+        traceFreed(TRACE_FREE, time, ptr);
+        return;
+    }
+    if (ptr == NULL) {
+        ALLOCATOR_ERROR("<free error>: passed null pointer\n");
+        return;
+    }
+
+    Block *block = findBlock(ptr);
+    if (block == NULL) {
+        ALLOCATOR_ERROR("<free error>: passed non-heap pointer\n");
+        return;
+    }
+
+    if (blockIsFree(block)) {
+        return;
+    }
+    allocatedBlockCount--;
+
+    size_t size = blockGetSize(block);
+    bytesFreedSincePurge += size;
+
+    // 1) Coalesce with NEXT if free
+    Block *next = blockNext(block);
+    if (blockIsFree(next)) {
+        removeFreeBlock(next);
+        size += blockGetSize(next);
+        next->header = 0; // header is absorbed, stale pointers must not match
+    }
+
+    // 2) Coalesce with PREV if free
+    if (block->header & BLOCK_PREV_FREE) {
+        Block *prev = blockPrev(block);
+        removeFreeBlock(prev);
+        size += blockGetSize(prev);
+        block->header = 0;
+        block = prev; // IMPORTANT: block is now the merged block
+    }
+    // neighbours of a free block are never free, so the merged block's
+    // previous block is allocated
+    blockSetHeader(block, size, 0);
+
+    // 3) Return the segment to the OS once it is empty, keeping the last one
+    if (blockGetSize(blockNext(block)) == 0) {
+        Segment* segment = (Segment*)addressMapFind(block, ADDRESS_MAP_SEGMENT);
+        if (block == segmentFirstBlock(segment) && (segment->prev != NULL || segment->next != NULL)) {
+            releaseSegment(segment);
+            return;
+        }
+    }
+
+    // 4) Otherwise keep the (merged) block in its size class list
+    releaseToFreeList(block, size);
+    if (bytesFreedSincePurge >= PURGE_INTERVAL) {
+        bytesFreedSincePurge = 0;
+        purgeFreeBlocks();
+    }
+}
+
+void* customCalloc(size_t nmemb, size_t size){
+    if(TRACING()){
+        traceBegin();
+        void* ptr = customCalloc(nmemb, size);
+        traceAllocated(TRACE_CALLOC, size, ptr, nmemb);
+        return ptr;
+    }
+    size_t total;
+    if(__builtin_mul_overflow(nmemb, size, &total) || total > BLOCK_SIZE_MASK - MIN_BLOCK_SIZE){
+        ALLOCATOR_ERROR("<calloc error>: requested size is too large\n");
+        return NULL;
+    }
+    size_t blockSize = blockSizeFor(total);
+    Block* block = bestFit(total);
+    if(blockSize >= FRESH_CALLOC_THRESHOLD && (block == NULL || !(block->header & BLOCK_ZERO))){
+        // rather than clear a large recycled block, map a segment just big
+        // enough and hand out all of it. nothing else can be carved from the
+        // segment, so freeing the block gives it back to the provider
+        Block* freshBlock = createSegment(blockSize, 0);
+        if(freshBlock != NULL){
+            block = freshBlock;
+            blockSize = blockGetSize(freshBlock);
+        }else if(block == NULL){
+            return NULL;
+        }
+    }else if(block == NULL){
+        block = createSegment(blockSize, SEGMENT_SIZE);
+        if(block == NULL){
+            return NULL;
+        }
+    }
+    block = takeFreeBlock(block, blockSize);
+    void* ptr = BLOCK_TO_PTR(block);
+    if(block->header & BLOCK_ZERO){
+        // only the old links and footer were ever written
+        memset(ptr, 0, sizeof(Block) - BLOCK_HEADER_SIZE);
+        *((size_t*)blockNext(block) - 1) = 0;
+        block->header &= ~BLOCK_ZERO;
+    }else{
+        memset(ptr, 0, total);
+    }
+    return ptr;
+}
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// cuts an allocated block down to blockSize and frees the tail when it can
+// hold a block of its own; the tail merges with a free successor
+static void shrinkBlock(Block* block, size_t blockSize){
+    size_t tailSize = blockGetSize(block) - blockSize;
+    if(tailSize < MIN_BLOCK_SIZE){
+        return;
+    }
+    blockSetHeader(block, blockSize, block->header & BLOCK_PREV_FREE);
+    Block* tail = blockNext(block);
+    blockSetHeader(tail, tailSize, 0);
+    allocatedBlockCount++; // freed below like any other allocated block
+    customFree(BLOCK_TO_PTR(tail));
+}
+
+// grows an allocated block into its successor when that one is free and
+// large enough. returns false, changing nothing, otherwise.
+static bool growBlockInPlace(Block* block, size_t blockSize){
+    size_t oldBlockSize = blockGetSize(block);
+    Block* next = blockNext(block);
+    if(!blockIsFree(next) || oldBlockSize + blockGetSize(next) < blockSize){
+        return false;
+    }
+    removeFreeBlock(next);
+    size_t mergedSize = oldBlockSize + blockGetSize(next);
+    next->header = 0; // header is absorbed, stale pointers must not match
+    blockSetHeader(block, mergedSize, block->header & BLOCK_PREV_FREE);
+    blockNext(block)->header &= ~BLOCK_PREV_FREE;
+    shrinkBlock(block, blockSize);
+    return true;
+}
+
+void* customRealloc(void* ptr, size_t size){
+    if(TRACING()){
+        unsigned long long time = traceBegin();
+        void* newPtr = customRealloc(ptr, size);
+        traceReallocated(TRACE_REALLOC, TRACE_REALLOC_RETURN, time, size, newPtr, ptr);
+        return newPtr;
+    }
+    if (ptr == NULL) {
+        return customMalloc(size);
+    }
+
+    Block *block = findBlock(ptr);
+    if (block == NULL || blockIsFree(block)) {
+        ALLOCATOR_ERROR("<realloc error>: passed non-heap pointer\n");
+        return NULL;
+    }
+    if(size == 0){
+        customFree(ptr);
+        return NULL;
+    }
+
+    size_t oldBlockSize = blockGetSize(block);
+    size_t newBlockSize = blockSizeFor(size);
+    if(newBlockSize == oldBlockSize){
+        return ptr;
+    }
+    // in place: give back the tail, or take over a free successor
+    if(newBlockSize < oldBlockSize){
+        shrinkBlock(block, newBlockSize);
+        return ptr;
+    }
+    if(growBlockInPlace(block, newBlockSize)){
+        return ptr;
+    }
+    void* newPtr = customMalloc(size);
+    if(newPtr == NULL){
+        return NULL;
+    }
+    memcpy(newPtr, ptr, MIN(size, oldBlockSize - BLOCK_HEADER_SIZE));
+    customFree(ptr);
+    return newPtr;
+}
+
+// bytes from a free block's start to the header of a block inside it whose
+// payload is aligned. leading slack must be able to stand alone as a block
+static size_t alignedLead(Block* block, size_t alignment){
+    uintptr_t payload = (uintptr_t)BLOCK_TO_PTR(block);
+    size_t lead = (size_t)(((payload + alignment - 1) & ~(uintptr_t)(alignment - 1)) - payload);
+    if(lead != 0 && lead < MIN_BLOCK_SIZE){
+        lead += alignment;
+    }
+    return lead;
+}
+
+void* customAlignedAlloc(size_t alignment, size_t size){
+    if(TRACING()){
+        traceBegin();
+        void* ptr = customAlignedAlloc(alignment, size);
+        traceAllocated(TRACE_ALIGNED_ALLOC, size, ptr, alignment);
+        return ptr;
+    }
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0){
+        ALLOCATOR_ERROR("<aligned alloc error>: alignment is not a power of two\n");
+        return NULL;
+    }
+    if(alignment <= MALLOC_ALIGNMENT){
+        return customMalloc(size);
+    }
+    if(size > BLOCK_SIZE_MASK - MIN_BLOCK_SIZE - 2 * alignment){
+        return NULL;
+    }
+    size_t blockSize = blockSizeFor(size);
+    // the best fit may happen to hold the aligned block; if not, take a block
+    // that holds it wherever the alignment falls
+    Block* block = bestFit(size);
+    if(block == NULL || alignedLead(block, alignment) + blockSize > blockGetSize(block)){
+        size_t worstCase = size + alignment + MIN_BLOCK_SIZE;
+        block = bestFit(worstCase);
+        if(block == NULL){
+            block = createSegment(blockSizeFor(worstCase), SEGMENT_SIZE);
+            if(block == NULL){
+                return NULL;
+            }
+        }
+    }
+    size_t lead = alignedLead(block, alignment);
+    if(lead == 0){
+        block = takeFreeBlock(block, blockSize);
+        block->header &= ~BLOCK_ZERO;
+        return BLOCK_TO_PTR(block);
+    }
+    // the leading slack stays free, the tail goes back as well
+    removeFreeBlock(block);
+    size_t freeSize = blockGetSize(block);
+    Block* alignedBlock = (Block*)((char*)block + lead);
+    blockSetHeader(alignedBlock, freeSize - lead, 0);
+    blockNext(alignedBlock)->header &= ~BLOCK_PREV_FREE;
+    releaseToFreeList(block, lead);
+    allocatedBlockCount++;
+    shrinkBlock(alignedBlock, blockSize);
+    return BLOCK_TO_PTR(alignedBlock);
+}
+
+static double fragmentation(size_t largestFreeBlock, size_t bytesFree){
+    return bytesFree == 0 ? 0.0 : 1.0 - (double)largestFreeBlock / (double)bytesFree;
+}
+
+// the counters are kept by the free list operations and the segment code;
+// only the largest free block is searched for, in the highest class in use
+MallocStats customMallocStats(){
+    MallocStats stats;
+    memset(&stats, 0, sizeof(MallocStats));
+    size_t blockBytes = 0;
+    for(Segment* segment = segmentList; segment != NULL; segment = segment->next){
+        blockBytes += segment->size - sizeof(Segment) - BLOCK_HEADER_SIZE;
+    }
+    for(size_t cls = NUM_SIZE_CLASSES; cls > 0 && stats.largestFreeBlock == 0; cls--){
+        for(Block* current = freeLists[cls - 1]; current != NULL; current = current->nextFree){
+            if(blockGetSize(current) > stats.largestFreeBlock){
+                stats.largestFreeBlock = blockGetSize(current);
+            }
+        }
+    }
+    stats.heapBytes = heapBytes;
+    stats.peakHeapBytes = peakHeapBytes;
+    stats.bytesInUse = blockBytes - freeBytes;
+    stats.bytesFree = freeBytes;
+    stats.allocatedBlocks = allocatedBlockCount;
+    stats.freeBlocks = freeBlockCount;
+    stats.fragmentation = fragmentation(stats.largestFreeBlock, stats.bytesFree);
+    return stats;
+}
+
+/*=============================================================================
+* regions
+* a region bumps through a chain of chunks taken from customMalloc. reset
+* only rewinds to the first chunk, so the chain is reused by the next round
+* of allocations; each new chunk is twice the size of the last.
+=============================================================================*/
+#define REGION_MIN_CHUNK_SIZE (256)
+
+typedef struct RegionChunk
+{
+    struct RegionChunk* next;
+    size_t size; // usable bytes after the header
+} RegionChunk;
+
+struct Region
+{
+    RegionChunk* first;
+    RegionChunk* current;
+    char* bump;
+    char* end;
+    size_t nextChunkSize;
+};
+
+static RegionChunk* createRegionChunk(size_t size){
+    if(size > BLOCK_SIZE_MASK - sizeof(RegionChunk) - MIN_BLOCK_SIZE){
+        return NULL;
+    }
+    RegionChunk* chunk = (RegionChunk*)customMalloc(sizeof(RegionChunk) + size);
+    if(chunk == NULL){
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
+
+// chunks double in size, up to where doubling would overflow
+static inline size_t doubledChunkSize(size_t size){
+    return size > SIZE_MAX / 2 ? size : size * 2;
+}
+
+static void regionEnterChunk(Region* region, RegionChunk* chunk){
+    region->current = chunk;
+    region->bump = (char*)(chunk + 1);
+    region->end = region->bump + chunk->size;
+}
+
+Region* regionCreate(size_t initialSize){
+    if(initialSize > SIZE_MAX - 15){
+        return NULL;
+    }
+    size_t chunkSize = ALIGN_TO_MULT_OF_16(initialSize < REGION_MIN_CHUNK_SIZE ? REGION_MIN_CHUNK_SIZE : initialSize);
+    Region* region = (Region*)customMalloc(sizeof(Region));
+    if(region == NULL){
+        return NULL;
+    }
+    RegionChunk* chunk = createRegionChunk(chunkSize);
+    if(chunk == NULL){
+        customFree(region);
+        return NULL;
+    }
+    region->first = chunk;
+    region->nextChunkSize = doubledChunkSize(chunkSize);
+    regionEnterChunk(region, chunk);
+    return region;
+}
+
+void* regionAlloc(Region* region, size_t size){
+    if(size > SIZE_MAX - 15){
+        return NULL;
+    }
+    size = ALIGN_TO_MULT_OF_16(size);
+    if(size <= (size_t)(region->end - region->bump)){
+        void* ptr = region->bump;
+        region->bump += size;
+        return ptr;
+    }
+    // move on to the next chunk kept from before a reset, or chain a new one
+    // in front of it when it is too small
+    RegionChunk* next = region->current->next;
+    if(next == NULL || next->size < size){
+        size_t chunkSize = region->nextChunkSize > size ? region->nextChunkSize : size;
+        RegionChunk* chunk = createRegionChunk(chunkSize);
+        if(chunk == NULL){
+            return NULL;
+        }
+        chunk->next = next;
+        region->current->next = chunk;
+        region->nextChunkSize = doubledChunkSize(chunkSize);
+        next = chunk;
+    }
+    regionEnterChunk(region, next);
+    void* ptr = region->bump;
+    region->bump += size;
+    return ptr;
+}
+
+void regionReset(Region* region){
+    regionEnterChunk(region, region->first);
+}
+
+void regionDestroy(Region* region){
+    RegionChunk* chunk = region->first;
+    while(chunk != NULL){
+        RegionChunk* next = chunk->next;
+        customFree(chunk);
+        chunk = next;
+    }
+    customFree(region);
+}
+
+/*=============================================================================
+* multi thread heap
+* block headers live inline in the area's data: [BlockMT | payload] ...
+* the header's last word, right before the payload, is the size word:
+* address tag | payload size | MT_* flags. it lets customMTFree classify a
+* pointer without taking any lock, and splitting or merging blocks only ever
+* needs the area's own mutex.
+* free blocks are also linked, through their payload, into the area's size
+* class lists; a bitmap of the non-empty classes finds the first list that
+* can serve a request without walking the empty ones.
+* an area starts as one MT_ZERO block. splitting passes the flag on, and
+* merging with another block or handing the block out drops it, so calloc
+* only has to clear the links of a block that still carries it.
+=============================================================================*/
+#define MT_SIZE_WORD(ptr) (*((size_t*)(ptr) - 1))
+#define MT_CACHED ((size_t)1) // block sits in a thread cache or a remote free list
+#define MT_LARGE ((size_t)2) // block has its own mapping
+#define MT_FREE ((size_t)4) // block is free inside its area
+#define MT_ZERO ((size_t)8) // free block never handed out: all but its links is zero
+
+// MT_CACHED is set and cleared without the area lock, while a thread holding
+// it may read the word through blockMTIsFree of a neighbour. every access
+// that can race like that is a relaxed atomic
+#define MT_SIZE_WORD_LOAD(ptr) __atomic_load_n(&MT_SIZE_WORD(ptr), __ATOMIC_RELAXED)
+#define MT_SIZE_WORD_STORE(ptr, word) __atomic_store_n(&MT_SIZE_WORD(ptr), (word), __ATOMIC_RELAXED)
+
+// free list links, stored in the payload of free blocks
+typedef struct FreeLinksMT
+{
+    BlockMT* nextFree;
+    BlockMT* prevFree;
+} FreeLinksMT;
+#define MT_FREE_LINKS(block) ((FreeLinksMT*)((block) + 1))
+#define MT_MIN_PAYLOAD (sizeof(FreeLinksMT))
+
+_Static_assert(AREA_SIZE_CLASSES == NUM_SIZE_CLASSES, "areas use the single thread heap's size classes");
+
+static inline size_t blockMTSize(BlockMT* block){
+    return block->sizeWord & BLOCK_SIZE_MASK;
+}
+
+static inline bool blockMTIsFree(BlockMT* block){
+    return (__atomic_load_n(&block->sizeWord, __ATOMIC_RELAXED) & MT_FREE) != 0;
+}
+
+static inline void blockMTSetSizeWord(BlockMT* block, size_t size, size_t flags){
+    block->sizeWord = BLOCK_TAG(block + 1) | size | flags;
+}
+
+// the area must be locked for all free list operations
+static void insertFreeBlockMT(MemoryArea* memoryArea, BlockMT* block){
+    size_t cls = sizeClass(blockMTSize(block));
+    FreeLinksMT* links = MT_FREE_LINKS(block);
+    links->prevFree = NULL;
+    links->nextFree = memoryArea->freeLists[cls];
+    if(links->nextFree != NULL){
+        MT_FREE_LINKS(links->nextFree)->prevFree = block;
+    }
+    memoryArea->freeLists[cls] = block;
+    classBitmapSet(memoryArea->freeListBitmap, cls);
+    memoryArea->freeBytes += blockMTSize(block);
+    memoryArea->freeBlockCount++;
+}
+
+static void removeFreeBlockMT(MemoryArea* memoryArea, BlockMT* block){
+    FreeLinksMT* links = MT_FREE_LINKS(block);
+    if(links->prevFree != NULL){
+        MT_FREE_LINKS(links->prevFree)->nextFree = links->nextFree;
+    }else{
+        size_t cls = sizeClass(blockMTSize(block));
+        memoryArea->freeLists[cls] = links->nextFree;
+        if(links->nextFree == NULL){
+            classBitmapClear(memoryArea->freeListBitmap, cls);
+        }
+    }
+    if(links->nextFree != NULL){
+        MT_FREE_LINKS(links->nextFree)->prevFree = links->prevFree;
+    }
+    memoryArea->freeBytes -= blockMTSize(block);
+    memoryArea->freeBlockCount--;
+}
+
+/*=============================================================================
+* thread caches
+* small blocks freed by a thread are kept in per-thread bins and handed out
+* again by customMTMalloc without touching any shared lock. a bin that
+* overflows is flushed back to the owning areas TCACHE_FLUSH_COUNT at a time.
+=============================================================================*/
+#define TCACHE_MAX_SIZE (256)
+#define TCACHE_BIN_STEP (16)
+#define TCACHE_NUM_BINS (TCACHE_MAX_SIZE / TCACHE_BIN_STEP)
+#define TCACHE_BIN_CAPACITY (16)
+#define TCACHE_FLUSH_COUNT (8)
+
+typedef struct TCacheEntry
+{
+    struct TCacheEntry* next;
+} TCacheEntry;
+
+typedef struct ThreadCache
+{
+    TCacheEntry* bins[TCACHE_NUM_BINS];
+    unsigned int counts[TCACHE_NUM_BINS];
+    MemoryArea* homeArea; // area this thread allocates from first
+    unsigned long generation; // heapGeneration the cached blocks belong to
+} ThreadCache;
+
+static _Thread_local ThreadCache threadCache;
+static _Atomic unsigned long heapGeneration = 0; // bumped by heapCreate/heapKill
+static pthread_key_t threadCacheKey;
+static pthread_once_t threadCacheKeyOnce = PTHREAD_ONCE_INIT;
+static _Atomic size_t memoryAreaCount = 0;
+static _Atomic size_t nextHomeArea = 0; // round robin for first-use assignment
+
+void freeBlockMT(MemoryArea* memoryArea, BlockMT* block);
+MemoryArea* findMemoryArea(void* ptr);
+BlockMT* findBlockMT(MemoryArea* memoryArea, void* ptr);
+
+// block size used for an MT request; small requests are rounded up to their
+// cache bin so any cached block of the bin can serve them
+static size_t blockSizeMT(size_t size){
+    if(size <= TCACHE_MAX_SIZE){
+        return size == 0 ? TCACHE_BIN_STEP : (size + TCACHE_BIN_STEP - 1) & ~(size_t)(TCACHE_BIN_STEP - 1);
+    }
+    return ALIGN_TO_MULT_OF_16(size);
+}
+
+/*=============================================================================
+* statistics
+* each thread counts its own mallocs and frees in a ThreadStats with relaxed
+* stores, so the hot paths never write to shared memory. the counters of
+* live threads are summed on read and an exiting thread folds its own into
+* retiredStats. free space is counted per area by the free list operations,
+* under the area lock they already hold.
+=============================================================================*/
+typedef struct ThreadStats
+{
+    _Atomic size_t bytesAllocated; // payload bytes
+    _Atomic size_t bytesFreed;
+    _Atomic size_t blocksAllocated;
+    _Atomic size_t blocksFreed;
+    _Atomic size_t lockContentions;
+    bool linked; // on threadStatsList
+    struct ThreadStats* next;
+    struct ThreadStats* prev;
+} ThreadStats;
+
+static _Thread_local ThreadStats threadStats;
+static ThreadStats* threadStatsList = NULL;
+static ThreadStats retiredStats; // counters of the threads that exited
+static pthread_mutex_t threadStatsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t threadStatsKey;
+static pthread_once_t threadStatsKeyOnce = PTHREAD_ONCE_INIT;
+static _Atomic size_t mappedBytesMT = 0; // areas and large blocks
+static _Atomic size_t peakMappedBytesMT = 0;
+
+// only the owning thread writes a counter, so no read-modify-write is needed
+static inline void statsAdd(_Atomic size_t* counter, size_t amount){
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+// adds every counter of `from` to `into`; threadStatsMutex must be held
+static void threadStatsFold(ThreadStats* into, ThreadStats* from){
+    statsAdd(&into->bytesAllocated, atomic_load_explicit(&from->bytesAllocated, memory_order_relaxed));
+    statsAdd(&into->bytesFreed, atomic_load_explicit(&from->bytesFreed, memory_order_relaxed));
+    statsAdd(&into->blocksAllocated, atomic_load_explicit(&from->blocksAllocated, memory_order_relaxed));
+    statsAdd(&into->blocksFreed, atomic_load_explicit(&from->blocksFreed, memory_order_relaxed));
+    statsAdd(&into->lockContentions, atomic_load_explicit(&from->lockContentions, memory_order_relaxed));
+}
+
+static void threadStatsClear(ThreadStats* stats){
+    atomic_store_explicit(&stats->bytesAllocated, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->bytesFreed, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->blocksAllocated, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->blocksFreed, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->lockContentions, 0, memory_order_relaxed);
+}
+
+// pthread key destructor - keeps the exiting thread's counts
+static void threadStatsDestroy(void* arg){
+    ThreadStats* stats = (ThreadStats*)arg;
+    pthread_mutex_lock(&threadStatsMutex);
+    threadStatsFold(&retiredStats, stats);
+    threadStatsClear(stats);
+    if(stats->prev != NULL){
+        stats->prev->next = stats->next;
+    }else{
+        threadStatsList = stats->next;
+    }
+    if(stats->next != NULL){
+        stats->next->prev = stats->prev;
+    }
+    stats->linked = false;
+    pthread_mutex_unlock(&threadStatsMutex);
+}
+
+static void threadStatsKeyCreate(){
+    pthread_key_create(&threadStatsKey, threadStatsDestroy);
+}
+
+static ThreadStats* getThreadStats(){
+    ThreadStats* stats = &threadStats;
+    if(!stats->linked){
+        pthread_once(&threadStatsKeyOnce, threadStatsKeyCreate);
+        pthread_mutex_lock(&threadStatsMutex);
+        stats->prev = NULL;
+        stats->next = threadStatsList;
+        if(threadStatsList != NULL){
+            threadStatsList->prev = stats;
+        }
+        threadStatsList = stats;
+        stats->linked = true;
+        pthread_mutex_unlock(&threadStatsMutex);
+        pthread_setspecific(threadStatsKey, stats);
+    }
+    return stats;
+}
+
+// a new or killed heap starts counting from zero; no other thread may be
+// using the heap
+static void resetThreadStats(){
+    pthread_mutex_lock(&threadStatsMutex);
+    threadStatsClear(&retiredStats);
+    for(ThreadStats* stats = threadStatsList; stats != NULL; stats = stats->next){
+        threadStatsClear(stats);
+    }
+    pthread_mutex_unlock(&threadStatsMutex);
+    atomic_store(&peakMappedBytesMT, atomic_load(&mappedBytesMT));
+}
+
+static inline void statsAllocated(size_t size){
+    ThreadStats* stats = getThreadStats();
+    statsAdd(&stats->bytesAllocated, size);
+    statsAdd(&stats->blocksAllocated, 1);
+}
+
+static inline void statsFreed(size_t size){
+    ThreadStats* stats = getThreadStats();
+    statsAdd(&stats->bytesFreed, size);
+    statsAdd(&stats->blocksFreed, 1);
+}
+
+// a block resized in place
+static inline void statsResized(size_t oldSize, size_t newSize){
+    ThreadStats* stats = getThreadStats();
+    if(newSize > oldSize){
+        statsAdd(&stats->bytesAllocated, newSize - oldSize);
+    }else{
+        statsAdd(&stats->bytesFreed, oldSize - newSize);
+    }
+}
+
+// mappings are rare next to mallocs, so these update shared counters
+static void statsMapped(size_t size){
+    size_t mapped = atomic_fetch_add(&mappedBytesMT, size) + size;
+    size_t peak = atomic_load(&peakMappedBytesMT);
+    while(mapped > peak && !atomic_compare_exchange_weak(&peakMappedBytesMT, &peak, mapped)){
+    }
+}
+
+static void statsUnmapped(size_t size){
+    atomic_fetch_sub(&mappedBytesMT, size);
+}
+
+// locks an area, counting the acquisitions that had to wait
+static void lockMemoryArea(MemoryArea* memoryArea){
+    if(profiledLock(&memoryArea->mutex, &memoryArea->lockProfile)){
+        statsAdd(&getThreadStats()->lockContentions, 1);
+        __atomic_fetch_add(&memoryArea->lockContentions, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static inline bool tryLockMemoryArea(MemoryArea* memoryArea){
+    return profiledTryLock(&memoryArea->mutex, &memoryArea->lockProfile);
+}
+
+static inline void unlockMemoryArea(MemoryArea* memoryArea){
+    profiledUnlock(&memoryArea->mutex, &memoryArea->lockProfile);
+}
+
+/*=============================================================================
+* remote frees
+* a block freed by a thread other than its area's owners is pushed onto the
+* area's remoteFreeList with a single CAS and keeps MT_CACHED while it waits.
+* a thread that locks the area to malloc, free, flush its cache, grow a
+* block or read stats takes the whole list at once and frees it under that
+* lock, and so does a thread leaving its home area when it exits.
+=============================================================================*/
+static void remoteFreePush(MemoryArea* memoryArea, void* ptr){
+    TCacheEntry* entry = (TCacheEntry*)ptr;
+    TCacheEntry* head = __atomic_load_n((TCacheEntry**)&memoryArea->remoteFreeList, __ATOMIC_RELAXED);
+    do{
+        entry->next = head;
+    }while(!__atomic_compare_exchange_n((TCacheEntry**)&memoryArea->remoteFreeList, &head, entry,
+                                        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// the area must be locked
+static void remoteFreeDrain(MemoryArea* memoryArea){
+    if(__atomic_load_n(&memoryArea->remoteFreeList, __ATOMIC_RELAXED) == NULL){
+        return;
+    }
+    TCacheEntry* entry = __atomic_exchange_n((TCacheEntry**)&memoryArea->remoteFreeList, NULL, __ATOMIC_ACQUIRE);
+    while(entry != NULL){
+        TCacheEntry* next = entry->next;
+        __atomic_fetch_and(&MT_SIZE_WORD(entry), ~MT_CACHED, __ATOMIC_RELAXED);
+        freeBlockMT(memoryArea, (BlockMT*)entry - 1);
+        entry = next;
+    }
+}
+
+// a thread owns its home area; every other area is freed into remotely
+static inline bool isForeignArea(ThreadCache* cache, MemoryArea* memoryArea){
+    return cache->homeArea != memoryArea;
+}
+
+static void tcacheFlush(ThreadCache* cache, size_t bin, unsigned int count){
+    MemoryArea* lockedArea = NULL;
+    while(count > 0 && cache->bins[bin] != NULL){
+        TCacheEntry* entry = cache->bins[bin];
+        cache->bins[bin] = entry->next;
+        cache->counts[bin]--;
+        count--;
+
+        MemoryArea* memoryArea = findMemoryArea(entry);
+        if(isForeignArea(cache, memoryArea)){
+            remoteFreePush(memoryArea, entry);
+            continue;
+        }
+        // consecutive blocks of the home area are freed under a single lock
+        MT_SIZE_WORD_STORE(entry, MT_SIZE_WORD_LOAD(entry) & ~MT_CACHED);
+        if(memoryArea != lockedArea){
+            if(lockedArea != NULL){
+                unlockMemoryArea(lockedArea);
+            }
+            lockMemoryArea(memoryArea);
+            remoteFreeDrain(memoryArea);
+            lockedArea = memoryArea;
+        }
+        freeBlockMT(memoryArea, findBlockMT(memoryArea, entry));
+    }
+    if(lockedArea != NULL){
+        unlockMemoryArea(lockedArea);
+    }
+}
+
+static void tcacheFlushAll(ThreadCache* cache){
+    for(size_t bin = 0; bin < TCACHE_NUM_BINS; bin++){
+        tcacheFlush(cache, bin, cache->counts[bin]);
+    }
+}
+
+// pthread key destructor - returns the exiting thread's cached blocks
+static void threadCacheDestroy(void* arg){
+    ThreadCache* cache = (ThreadCache*)arg;
+    if(cache->generation == atomic_load(&heapGeneration)){
+        tcacheFlushAll(cache);
+        // no thread may malloc from the home area again, so it is drained here
+        if(cache->homeArea != NULL){
+            lockMemoryArea(cache->homeArea);
+            remoteFreeDrain(cache->homeArea);
+            unlockMemoryArea(cache->homeArea);
+        }
+    }
+}
+
+static void threadCacheKeyCreate(){
+    pthread_key_create(&threadCacheKey, threadCacheDestroy);
+}
+
+// the calling thread's cache, emptied if it still refers to a killed heap
+static ThreadCache* getThreadCache(){
+    ThreadCache* cache = &threadCache;
+    unsigned long generation = atomic_load(&heapGeneration);
+    if(cache->generation != generation){
+        memset(cache, 0, sizeof(ThreadCache));
+        cache->generation = generation;
+        pthread_once(&threadCacheKeyOnce, threadCacheKeyCreate);
+        pthread_setspecific(threadCacheKey, cache);
+    }
+    return cache;
+}
+
+static void* tcacheGet(size_t blockSize){
+    ThreadCache* cache = getThreadCache();
+    size_t bin = blockSize / TCACHE_BIN_STEP - 1;
+    TCacheEntry* entry = cache->bins[bin];
+    if(entry == NULL){
+        return NULL;
+    }
+    cache->bins[bin] = entry->next;
+    cache->counts[bin]--;
+    MT_SIZE_WORD_STORE(entry, MT_SIZE_WORD_LOAD(entry) & ~MT_CACHED);
+    statsAllocated(blockSize);
+    return (void*)entry;
+}
+
+// returns true when ptr was taken care of (cached, or reported as a double
+// free); false sends it down the locked path, which also validates it
+static bool tcachePut(void* ptr){
+    MemoryArea* memoryArea = findMemoryArea(ptr);
+    if(memoryArea == NULL || findBlockMT(memoryArea, ptr) == NULL){
+        return false;
+    }
+    size_t sizeWord = MT_SIZE_WORD_LOAD(ptr);
+    if(sizeWord & (MT_CACHED | MT_FREE)){
+        ALLOCATOR_ERROR("<free error>: passed non-heap pointer\n");
+        return true;
+    }
+    size_t blockSize = sizeWord & BLOCK_SIZE_MASK;
+    if(blockSize > TCACHE_MAX_SIZE || blockSize % TCACHE_BIN_STEP != 0){
+        return false;
+    }
+
+    statsFreed(blockSize);
+    ThreadCache* cache = getThreadCache();
+    size_t bin = blockSize / TCACHE_BIN_STEP - 1;
+    TCacheEntry* entry = (TCacheEntry*)ptr;
+    MT_SIZE_WORD_STORE(ptr, sizeWord | MT_CACHED);
+    entry->next = cache->bins[bin];
+    cache->bins[bin] = entry;
+    cache->counts[bin]++;
+    if(cache->counts[bin] > TCACHE_BIN_CAPACITY){
+        tcacheFlush(cache, bin, TCACHE_FLUSH_COUNT);
+    }
+    return true;
+}
+
+/*=============================================================================
+* large blocks
+* requests above largeAllocationThreshold get a private mapping:
+* [alignment slack | LargeBlock | payload]. the header always lies in the
+* mapping's first address map unit, whose entry points at it, so the header
+* and the mapping are both found from the user pointer alone.
+=============================================================================*/
+typedef struct LargeBlock
+{
+    size_t mapSize; // bytes mapped, header included
+    struct LargeBlock* next;
+    struct LargeBlock* prev;
+    size_t sizeWord; // MT size word of the payload: tag | size | MT_LARGE
+} LargeBlock;
+
+size_t largeAllocationThreshold = DEFAULT_LARGE_THRESHOLD; // global
+static LargeBlock* largeBlockList = NULL;
+static pthread_mutex_t largeBlockListMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void customMTSetLargeThreshold(size_t threshold){
+    largeAllocationThreshold = threshold;
+}
+
+// offset of the payload into the mapping for a given alignment
+static size_t largePayloadOffset(size_t alignment){
+    return alignment > sizeof(LargeBlock) ? alignment : sizeof(LargeBlock);
+}
+
+static size_t largeMapSize(size_t payloadOffset, size_t size){
+    return (payloadOffset + size + pageSize() - 1) & ~(pageSize() - 1);
+}
+
+static inline char* largeMapStart(LargeBlock* large){
+    return (char*)((uintptr_t)large & ~(uintptr_t)(PAGE_PROVIDER_ALIGNMENT - 1));
+}
+
+static LargeBlock* findLargeBlock(void* ptr){
+    LargeBlock* large = (LargeBlock*)addressMapFind(ptr, ADDRESS_MAP_LARGE);
+    if(large == NULL || ptr != (void*)(large + 1)){
+        return NULL;
+    }
+    size_t sizeWord = MT_SIZE_WORD_LOAD(ptr);
+    if((sizeWord & BLOCK_TAG_MASK) != BLOCK_TAG(ptr) || (sizeWord & MT_LARGE) == 0){
+        return NULL;
+    }
+    return (LargeBlock*)ptr - 1;
+}
+
+static void linkLargeBlock(LargeBlock* large){
+    large->prev = NULL;
+    large->next = largeBlockList;
+    if(largeBlockList != NULL){
+        largeBlockList->prev = large;
+    }
+    largeBlockList = large;
+}
+
+static void unlinkLargeBlock(LargeBlock* large){
+    if(large->prev != NULL){
+        large->prev->next = large->next;
+    }else{
+        largeBlockList = large->next;
+    }
+    if(large->next != NULL){
+        large->next->prev = large->prev;
+    }
+}
+
+// alignment is at most PAGE_PROVIDER_ALIGNMENT
+static void* mallocLarge(size_t size, size_t alignment){
+    size_t payloadOffset = largePayloadOffset(alignment);
+    if(size > BLOCK_SIZE_MASK - pageSize() - payloadOffset){
+        ALLOCATOR_ERROR("<malloc error>: requested size is too large\n");
+        return NULL;
+    }
+    size_t mapSize = largeMapSize(payloadOffset, size);
+    char* region = (char*)pageProvider.map(mapSize);
+    if(region == NULL){
+        return NULL;
+    }
+    LargeBlock* large = (LargeBlock*)(region + payloadOffset) - 1;
+    if(!addressMapSet(region, mapSize, (uintptr_t)large | ADDRESS_MAP_LARGE)){
+        pageProvider.unmap(region, mapSize);
+        return NULL;
+    }
+    large->mapSize = mapSize;
+    large->sizeWord = BLOCK_TAG(large + 1) | ALIGN_TO_MULT_OF_16(size) | MT_LARGE;
+    profiledLock(&largeBlockListMutex, &largeBlockListLockProfile);
+    linkLargeBlock(large);
+    profiledUnlock(&largeBlockListMutex, &largeBlockListLockProfile);
+    statsMapped(mapSize);
+    statsAllocated(large->sizeWord & BLOCK_SIZE_MASK);
+    return (void*)(large + 1);
+}
+
+static void freeLarge(LargeBlock* large){
+    profiledLock(&largeBlockListMutex, &largeBlockListLockProfile);
+    unlinkLargeBlock(large);
+    profiledUnlock(&largeBlockListMutex, &largeBlockListLockProfile);
+    statsFreed(large->sizeWord & BLOCK_SIZE_MASK);
+    statsUnmapped(large->mapSize);
+    large->sizeWord = 0;
+    addressMapSet(largeMapStart(large), large->mapSize, 0);
+    pageProvider.unmap(largeMapStart(large), large->mapSize);
+}
+
+// grows or shrinks the mapping in place when possible; the kernel moves the
+// pages instead of copying them when it cannot. providers without remap get
+// a fresh mapping and a copy. the old range leaves the address map before it
+// can be handed out again.
+static void* reallocLarge(LargeBlock* large, size_t size){
+    char* start = largeMapStart(large);
+    size_t payloadOffset = (size_t)((char*)(large + 1) - start);
+    size_t mapSize = largeMapSize(payloadOffset, size);
+    if(mapSize == large->mapSize){
+        statsResized(large->sizeWord & BLOCK_SIZE_MASK, ALIGN_TO_MULT_OF_16(size));
+        large->sizeWord = BLOCK_TAG(large + 1) | ALIGN_TO_MULT_OF_16(size) | MT_LARGE;
+        return (void*)(large + 1);
+    }
+    size_t oldMapSize = large->mapSize;
+    char* movedStart = NULL;
+    if(pageProvider.remap == NULL){
+        movedStart = (char*)pageProvider.map(mapSize);
+        if(movedStart == NULL){
+            return NULL;
+        }
+        LargeBlock* moved = (LargeBlock*)(movedStart + payloadOffset) - 1;
+        if(!addressMapSet(movedStart, mapSize, (uintptr_t)moved | ADDRESS_MAP_LARGE)){
+            pageProvider.unmap(movedStart, mapSize);
+            return NULL;
+        }
+        memcpy(movedStart, start, MIN(oldMapSize, mapSize));
+        profiledLock(&largeBlockListMutex, &largeBlockListLockProfile);
+        unlinkLargeBlock(large);
+        addressMapSet(start, oldMapSize, 0);
+        pageProvider.unmap(start, oldMapSize);
+    }else{
+        profiledLock(&largeBlockListMutex, &largeBlockListLockProfile);
+        unlinkLargeBlock(large);
+        addressMapSet(start, oldMapSize, 0);
+        movedStart = (char*)pageProvider.remap(start, oldMapSize, mapSize);
+        if(movedStart != NULL &&
+           !addressMapSet(movedStart, mapSize, (uintptr_t)((LargeBlock*)(movedStart + payloadOffset) - 1) | ADDRESS_MAP_LARGE)){
+            // cannot index the new range; give the mapping its old size back
+            char* restored = (char*)pageProvider.remap(movedStart, mapSize, oldMapSize);
+            start = restored != NULL ? restored : movedStart;
+            large = (LargeBlock*)(start + payloadOffset) - 1;
+            movedStart = NULL;
+        }
+        if(movedStart == NULL){
+            addressMapSet(start, oldMapSize, (uintptr_t)large | ADDRESS_MAP_LARGE);
+            linkLargeBlock(large);
+            profiledUnlock(&largeBlockListMutex, &largeBlockListLockProfile);
+            return NULL;
+        }
+    }
+    LargeBlock* moved = (LargeBlock*)(movedStart + payloadOffset) - 1;
+    statsResized(moved->sizeWord & BLOCK_SIZE_MASK, ALIGN_TO_MULT_OF_16(size));
+    statsUnmapped(oldMapSize);
+    statsMapped(mapSize);
+    moved->mapSize = mapSize;
+    moved->sizeWord = BLOCK_TAG(moved + 1) | ALIGN_TO_MULT_OF_16(size) | MT_LARGE;
+    linkLargeBlock(moved);
+    profiledUnlock(&largeBlockListMutex, &largeBlockListLockProfile);
+    return (void*)(moved + 1);
+}
+
+static void freeLargeBlockList(){
+    profiledLock(&largeBlockListMutex, &largeBlockListLockProfile);
+    while(largeBlockList != NULL){
+        LargeBlock* large = largeBlockList;
+        largeBlockList = large->next;
+        statsUnmapped(large->mapSize);
+        large->sizeWord = 0;
+        addressMapSet(largeMapStart(large), large->mapSize, 0);
+        pageProvider.unmap(largeMapStart(large), large->mapSize);
+    }
+    profiledUnlock(&largeBlockListMutex, &largeBlockListLockProfile);
+}
+
+void freeMemoryArea(MemoryArea* memoryArea){
+    // the descriptor and the block headers live in the mapping and go with it
+    size_t mapSize = AREA_HEADER_SIZE + memoryArea->size;
+    pthread_mutex_destroy(&memoryArea->mutex);
+    statsUnmapped(mapSize);
+    addressMapSet(memoryArea, mapSize, 0);
+    pageProvider.unmap(memoryArea, mapSize);
+}
+
+void freeMemoryAreaList(){
+    MemoryArea* current = memoryAreaList;
+    while(current != NULL){
+        MemoryArea* next = current->next;
+        freeMemoryArea(current);
+        current = next;
+    }
+    memoryAreaList = NULL;
+    lastMemoryArea = NULL;
+    atomic_store(&memoryAreaCount, 0);
+}
+
+
+// each area is a mapping of its own, rounded up to whole address map units,
+// so a pointer finds its area with one addressMapFind. the descriptor sits
+// at the start of the mapping, in front of the data
+MemoryArea* createMemoryArea(size_t size){
+    // locking before function call
+    if(size > BLOCK_SIZE_MASK - sizeof(BlockMT) - AREA_HEADER_SIZE - PAGE_PROVIDER_ALIGNMENT){
+        return NULL;
+    }
+    size_t mapSize = (AREA_HEADER_SIZE + size + sizeof(BlockMT) + PAGE_PROVIDER_ALIGNMENT - 1) & ~(size_t)(PAGE_PROVIDER_ALIGNMENT - 1);
+    MemoryArea* newMemoryArea = (MemoryArea*)pageProvider.map(mapSize);
+    if(newMemoryArea == NULL){
+        return NULL;
+    }
+    // Initialize the area's data, room for the first block's header included
+    newMemoryArea->dataPtr = (char*)newMemoryArea + AREA_HEADER_SIZE;
+    newMemoryArea->size = mapSize - AREA_HEADER_SIZE;
+    // Initialize the area's block list: one free block spanning the data
+    newMemoryArea->blockList = (BlockMT*)newMemoryArea->dataPtr;
+    newMemoryArea->blockList->next = NULL;
+    newMemoryArea->blockList->prev = NULL;
+    blockMTSetSizeWord(newMemoryArea->blockList, newMemoryArea->size - sizeof(BlockMT), MT_FREE | MT_ZERO);
+    memset(newMemoryArea->freeLists, 0, sizeof(newMemoryArea->freeLists));
+    memset(newMemoryArea->freeListBitmap, 0, sizeof(newMemoryArea->freeListBitmap));
+    newMemoryArea->freeBytes = 0;
+    newMemoryArea->freeBlockCount = 0;
+    newMemoryArea->lockContentions = 0;
+    memset(&newMemoryArea->lockProfile, 0, sizeof(LockProfile));
+    insertFreeBlockMT(newMemoryArea, newMemoryArea->blockList);
+
+    newMemoryArea->remoteFreeList = NULL;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&newMemoryArea->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    newMemoryArea->next = NULL;
+
+    if(!addressMapSet(newMemoryArea, mapSize, (uintptr_t)newMemoryArea | ADDRESS_MAP_AREA)){
+        pthread_mutex_destroy(&newMemoryArea->mutex);
+        pageProvider.unmap(newMemoryArea, mapSize);
+        return NULL;
+    }
+    statsMapped(mapSize);
+    return newMemoryArea;
+}
+
+// publishes a fully initialized area at the tail of the list. the list is
+// only ever appended to, so readers may walk it without memoryAreaListMutex.
+// memoryAreaListMutex must be held.
+static void appendMemoryArea(MemoryArea* memoryArea){
+    if(memoryAreaList == NULL){
+        __atomic_store_n(&memoryAreaList, memoryArea, __ATOMIC_RELEASE);
+    }else{
+        __atomic_store_n(&lastMemoryArea->next, memoryArea, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&lastMemoryArea, memoryArea, __ATOMIC_RELEASE);
+    atomic_fetch_add(&memoryAreaCount, 1);
+}
+
+/*=============================================================================
+* heap configuration
+=============================================================================*/
+static HeapConfig heapConfig; // config of the live heap
+static size_t nextAreaSize = 0; // size of the next area added on growth
+
+static size_t readEnvSize(const char* name, size_t fallback){
+    const char* value = getenv(name);
+    if(value == NULL || *value == '\0'){
+        return fallback;
+    }
+    char* end = NULL;
+    unsigned long long parsed = strtoull(value, &end, 0);
+    // accept K/M/G suffixes, e.g. CUSTOM_ALLOCATOR_AREA_SIZE=2M
+    switch(*end){
+        case 'k': case 'K': parsed <<= 10; break;
+        case 'm': case 'M': parsed <<= 20; break;
+        case 'g': case 'G': parsed <<= 30; break;
+        default: break;
+    }
+    return (size_t)parsed;
+}
+
+void heapDefaultConfig(HeapConfig* config){
+    config->initialAreaCount = readEnvSize("CUSTOM_ALLOCATOR_AREA_COUNT", DEFAULT_MEMORY_AREA_COUNT);
+    config->areaSize = readEnvSize("CUSTOM_ALLOCATOR_AREA_SIZE", DEFAULT_MEMORY_AREA_SIZE);
+    config->growth = readEnvSize("CUSTOM_ALLOCATOR_GEOMETRIC_GROWTH", 0) ? AREA_GROWTH_GEOMETRIC : AREA_GROWTH_FIXED;
+    config->growthFactor = readEnvSize("CUSTOM_ALLOCATOR_GROWTH_FACTOR", DEFAULT_AREA_GROWTH_FACTOR);
+    config->maxAreaSize = readEnvSize("CUSTOM_ALLOCATOR_MAX_AREA_SIZE", DEFAULT_MAX_MEMORY_AREA_SIZE);
+    config->areaRounding = readEnvSize("CUSTOM_ALLOCATOR_AREA_ROUNDING", 0);
+    config->largeThreshold = readEnvSize("CUSTOM_ALLOCATOR_LARGE_THRESHOLD", 0);
+}
+
+static size_t roundAreaSize(size_t size){
+    size_t rounding = heapConfig.areaRounding;
+    if(rounding == 0){
+        return size;
+    }
+    // the rounding covers the whole area, the first block header included
+    size_t total = (size + sizeof(BlockMT) + rounding - 1) / rounding * rounding;
+    return total - sizeof(BlockMT);
+}
+
+// size of the area to add for a request of blockSize bytes. advances the
+// geometric growth; memoryAreaListMutex must be held.
+static size_t takeNextAreaSize(size_t blockSize){
+    size_t size = nextAreaSize;
+    if(heapConfig.growth == AREA_GROWTH_GEOMETRIC){
+        size_t grown = nextAreaSize * heapConfig.growthFactor;
+        nextAreaSize = grown > heapConfig.maxAreaSize ? heapConfig.maxAreaSize : grown;
+        if(nextAreaSize < size){
+            nextAreaSize = size;
+        }
+    }
+    return roundAreaSize(size > blockSize ? size : blockSize);
+}
+
+void heapCreate(){
+    heapCreateWithConfig(NULL);
+}
+
+void heapCreateWithConfig(const HeapConfig* config){
+    if(config != NULL){
+        heapConfig = *config;
+    }else{
+        heapDefaultConfig(&heapConfig);
+    }
+    if(heapConfig.areaSize < sizeof(BlockMT) + MT_MIN_PAYLOAD){
+        heapConfig.areaSize = DEFAULT_MEMORY_AREA_SIZE;
+    }
+    if(heapConfig.growthFactor < 2){
+        heapConfig.growthFactor = DEFAULT_AREA_GROWTH_FACTOR;
+    }
+    nextAreaSize = heapConfig.areaSize;
+    // areas are mapped in whole address map units, so even small ones have
+    // room for blocks well above areaSize; only big requests pay for a mapping
+    if(heapConfig.largeThreshold != 0){
+        largeAllocationThreshold = heapConfig.largeThreshold;
+    }else{
+        largeAllocationThreshold = heapConfig.areaSize > DEFAULT_LARGE_THRESHOLD ? heapConfig.areaSize : DEFAULT_LARGE_THRESHOLD;
+    }
+
+    pthread_mutex_init(&heapSizeModificationMutex, NULL);
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&memoryAreaListMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    profiledLock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+    atomic_fetch_add(&heapGeneration, 1);
+    resetThreadStats();
+
+    size_t initialAreaSize = roundAreaSize(heapConfig.areaSize);
+    for (size_t i = 0; i < heapConfig.initialAreaCount; i++){
+        MemoryArea* newMemoryArea = createMemoryArea(initialAreaSize);
+        if(newMemoryArea == NULL){
+            freeMemoryAreaList();
+            profiledUnlock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+            return;
+        }
+
+        appendMemoryArea(newMemoryArea);
+    }
+
+    profiledUnlock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+}
+
+void heapKill(){
+    profiledLock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+    if(memoryAreaList == NULL){
+        profiledUnlock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+        return;
+    }
+    // blocks still sitting in thread caches die with their areas
+    atomic_fetch_add(&heapGeneration, 1);
+    freeMemoryAreaList();
+    freeLargeBlockList();
+    resetThreadStats();
+    profiledUnlock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+
+    pthread_mutex_destroy(&memoryAreaListMutex);
+    pthread_mutex_destroy(&heapSizeModificationMutex);
+}
+
+/*=============================================================================
+* fork safety
+* prepare takes every allocator mutex in lock order, so the child gets the
+* heap in a consistent state. the child cannot unlock the recursive mutexes
+* it inherited, their owner is a thread id of the parent, so it initializes
+* them afresh. blocks in the caches of the other threads leak in the child.
+=============================================================================*/
+static void initRecursiveMutex(pthread_mutex_t* mutex){
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void customMTForkPrepare(){
+    pthread_mutex_lock(&memoryAreaListMutex);
+    pthread_mutex_lock(&heapSizeModificationMutex);
+    for(MemoryArea* memoryArea = memoryAreaList; memoryArea != NULL; memoryArea = memoryArea->next){
+        pthread_mutex_lock(&memoryArea->mutex);
+    }
+    pthread_mutex_lock(&largeBlockListMutex);
+    pthread_mutex_lock(&addressMapMutex);
+    pthread_mutex_lock(&threadStatsMutex);
+    pthread_mutex_lock(&traceMutex);
+}
+
+void customMTForkParent(){
+    pthread_mutex_unlock(&traceMutex);
+    pthread_mutex_unlock(&threadStatsMutex);
+    pthread_mutex_unlock(&addressMapMutex);
+    pthread_mutex_unlock(&largeBlockListMutex);
+    for(MemoryArea* memoryArea = memoryAreaList; memoryArea != NULL; memoryArea = memoryArea->next){
+        pthread_mutex_unlock(&memoryArea->mutex);
+    }
+    pthread_mutex_unlock(&heapSizeModificationMutex);
+    pthread_mutex_unlock(&memoryAreaListMutex);
+}
+
+void customMTForkChild(){
+    pthread_mutex_init(&traceMutex, NULL);
+    pthread_mutex_init(&threadStatsMutex, NULL);
+    pthread_mutex_init(&addressMapMutex, NULL);
+    pthread_mutex_init(&largeBlockListMutex, NULL);
+    for(MemoryArea* memoryArea = memoryAreaList; memoryArea != NULL; memoryArea = memoryArea->next){
+        initRecursiveMutex(&memoryArea->mutex);
+    }
+    pthread_mutex_init(&heapSizeModificationMutex, NULL);
+    initRecursiveMutex(&memoryAreaListMutex);
+}
+
+BlockMT* bestFitMT(MemoryArea* memoryArea, size_t size){
+    // the request's own class may also hold blocks that are too small,
+    // unless it is exact
+    size_t cls = sizeClass(size);
+    BlockMT* current = memoryArea->freeLists[cls];
+    if(isExactClass(cls) && current != NULL){
+        return current;
+    }
+    BlockMT* bestBlock = NULL;
+    size_t bestSize = (size_t)(-1); // highest possible size
+    for(int i = 0; current != NULL && i < FREE_LIST_SCAN_LIMIT; i++){
+        size_t currentSize = blockMTSize(current);
+        if(currentSize >= size && currentSize < bestSize){
+            bestBlock = current;
+            bestSize = currentSize;
+            if(currentSize == size){
+                break;
+            }
+        }
+        current = MT_FREE_LINKS(current)->nextFree;
+    }
+    if(bestBlock != NULL){
+        return bestBlock;
+    }
+    // every block of a higher class fits
+    cls = firstSetClass(memoryArea->freeListBitmap, cls + 1);
+    return cls < NUM_SIZE_CLASSES ? memoryArea->freeLists[cls] : NULL;
+}
 
-    BlockMT* block = findBlockMT(memoryArea, ptr);
-    if(block == NULL){
-        printf("<free error>: passed non-heap pointer\n");
-        pthread_mutex_unlock(&memoryArea->mutex);
+// splits off everything past the first `size` payload bytes of an allocated
+// block when the rest can hold a header and MT_MIN_PAYLOAD. the rest is
+// freed, merging with a free successor. the area must be locked.
+static void splitBlockMT(MemoryArea* memoryArea, BlockMT* block, size_t size){
+    size_t blockSize = blockMTSize(block);
+    if(blockSize < size + sizeof(BlockMT) + MT_MIN_PAYLOAD){
         return;
     }
-    if(block->free){
-        printf("<free error>: passed non-heap pointer\n");
-        pthread_mutex_unlock(&memoryArea->mutex);
+    size_t zero = block->sizeWord & MT_ZERO;
+    BlockMT* newBlock = (BlockMT*)((char*)(block + 1) + size);
+    blockMTSetSizeWord(newBlock, blockSize - size - sizeof(BlockMT), zero);
+    blockMTSetSizeWord(block, size, zero);
+
+    newBlock->prev = block;
+    newBlock->next = block->next;
+    block->next = newBlock;
+    if (newBlock->next != NULL){
+        newBlock->next->prev = newBlock;
+    }
+    freeBlockMT(memoryArea, newBlock);
+}
+
+// payload bytes in front of the first aligned payload inside a free block.
+// leading slack must be able to stand alone as a block
+static size_t alignedLeadMT(BlockMT* block, size_t alignment){
+    uintptr_t payload = (uintptr_t)(block + 1);
+    size_t lead = (size_t)(((payload + alignment - 1) & ~(uintptr_t)(alignment - 1)) - payload);
+    if(lead != 0 && lead < sizeof(BlockMT) + MT_MIN_PAYLOAD){
+        lead += alignment;
+    }
+    return lead;
+}
+
+// free payload a block needs to hold blockSize bytes at any alignment
+static size_t alignedFitSizeMT(size_t blockSize, size_t alignment){
+    if(alignment <= MALLOC_ALIGNMENT){
+        return blockSize;
+    }
+    return blockSize + alignment + sizeof(BlockMT) + MT_MIN_PAYLOAD;
+}
+
+// carves blockSize bytes with the given payload alignment out of an area the
+// caller has locked. returns NULL when no free block is large enough. when
+// zeroed is not NULL, it tells whether the payload is all zero; the links
+// of an MT_ZERO block are cleared to make it so
+static void* mallocFromArea(MemoryArea* memoryArea, size_t blockSize, size_t alignment, bool* zeroed){
+    remoteFreeDrain(memoryArea);
+    BlockMT* bestBlock = bestFitMT(memoryArea, blockSize);
+    if(alignment > MALLOC_ALIGNMENT &&
+       (bestBlock == NULL || alignedLeadMT(bestBlock, alignment) + blockSize > blockMTSize(bestBlock))){
+        bestBlock = bestFitMT(memoryArea, alignedFitSizeMT(blockSize, alignment));
+    }
+    if(bestBlock == NULL){
+        return NULL;
+    }
+    removeFreeBlockMT(memoryArea, bestBlock);
+    size_t zero = bestBlock->sizeWord & MT_ZERO;
+    blockMTSetSizeWord(bestBlock, blockMTSize(bestBlock), zero);
+    BlockMT* block = bestBlock;
+    size_t lead = alignment > MALLOC_ALIGNMENT ? alignedLeadMT(bestBlock, alignment) : 0;
+    if(lead != 0){
+        // the leading slack becomes a free block of its own
+        block = (BlockMT*)((char*)(bestBlock + 1) + lead) - 1;
+        blockMTSetSizeWord(block, blockMTSize(bestBlock) - lead, zero);
+        blockMTSetSizeWord(bestBlock, lead - sizeof(BlockMT), zero);
+        block->prev = bestBlock;
+        block->next = bestBlock->next;
+        bestBlock->next = block;
+        if(block->next != NULL){
+            block->next->prev = block;
+        }
+        freeBlockMT(memoryArea, bestBlock);
+    }
+    splitBlockMT(memoryArea, block, blockSize);
+    block->sizeWord &= ~MT_ZERO;
+    if(zeroed != NULL){
+        *zeroed = zero != 0;
+        if(zero){
+            memset(MT_FREE_LINKS(block), 0, MT_MIN_PAYLOAD);
+        }
+    }
+    statsAllocated(blockMTSize(block));
+    return (void*)(block + 1);
+}
+
+static MemoryArea* nextMemoryArea(MemoryArea* memoryArea){
+    MemoryArea* next = __atomic_load_n(&memoryArea->next, __ATOMIC_ACQUIRE);
+    return next != NULL ? next : __atomic_load_n(&memoryAreaList, __ATOMIC_ACQUIRE);
+}
+
+// the calling thread's home area, assigned round robin on first use
+static MemoryArea* homeMemoryArea(ThreadCache* cache){
+    if(cache->homeArea != NULL){
+        return cache->homeArea;
+    }
+    MemoryArea* memoryArea = __atomic_load_n(&memoryAreaList, __ATOMIC_ACQUIRE);
+    size_t count = atomic_load(&memoryAreaCount);
+    if(memoryArea == NULL || count == 0){
+        return NULL;
+    }
+    for(size_t skip = atomic_fetch_add(&nextHomeArea, 1) % count; skip > 0; skip--){
+        memoryArea = nextMemoryArea(memoryArea);
+    }
+    cache->homeArea = memoryArea;
+    return memoryArea;
+}
+
+// finds room for blockSize bytes in the areas, adding one when all are full
+static void* mallocFromAreas(size_t blockSize, size_t alignment, bool* zeroed){
+    ThreadCache* cache = getThreadCache();
+    MemoryArea* homeArea = homeMemoryArea(cache);
+    if(homeArea == NULL){
+        return NULL;
+    }
+    void* ptr = NULL;
+    MemoryArea* lastSeenArea = __atomic_load_n(&lastMemoryArea, __ATOMIC_ACQUIRE);
+
+    // 1) the home area, unless another thread is holding it right now
+    bool homeBusy = !tryLockMemoryArea(homeArea);
+    if(!homeBusy){
+        ptr = mallocFromArea(homeArea, blockSize, alignment, zeroed);
+        unlockMemoryArea(homeArea);
+        if(ptr != NULL){
+            return ptr;
+        }
+    }
+
+    // 2) steal from any other area that is not locked
+    for(MemoryArea* memoryArea = nextMemoryArea(homeArea); memoryArea != homeArea; memoryArea = nextMemoryArea(memoryArea)){
+        if(!tryLockMemoryArea(memoryArea)){
+            continue;
+        }
+        ptr = mallocFromArea(memoryArea, blockSize, alignment, zeroed);
+        unlockMemoryArea(memoryArea);
+        if(ptr != NULL){
+            return ptr;
+        }
+    }
+
+    // 3) everyone else is busy or full; wait for home
+    if(homeBusy){
+        lockMemoryArea(homeArea);
+        ptr = mallocFromArea(homeArea, blockSize, alignment, zeroed);
+        unlockMemoryArea(homeArea);
+        if(ptr != NULL){
+            return ptr;
+        }
+    }
+
+    // 4) the heap is exhausted; add an area and move this thread onto it.
+    // another thread may have just done so, in which case try that area first
+    profiledLock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+    if(lastMemoryArea != NULL && lastMemoryArea != lastSeenArea){
+        MemoryArea* newestArea = lastMemoryArea;
+        lockMemoryArea(newestArea);
+        ptr = mallocFromArea(newestArea, blockSize, alignment, zeroed);
+        unlockMemoryArea(newestArea);
+        if(ptr != NULL){
+            profiledUnlock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+            cache->homeArea = newestArea;
+            return ptr;
+        }
+    }
+    profiledLock(&heapSizeModificationMutex, &heapSizeModificationLockProfile);
+    MemoryArea* newMemoryArea = createMemoryArea(takeNextAreaSize(alignedFitSizeMT(blockSize, alignment)));
+    profiledUnlock(&heapSizeModificationMutex, &heapSizeModificationLockProfile);
+    if(newMemoryArea == NULL){
+        profiledUnlock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+        return NULL;
+    }
+    lockMemoryArea(newMemoryArea);
+    appendMemoryArea(newMemoryArea);
+    profiledUnlock(&memoryAreaListMutex, &memoryAreaListLockProfile);
+    ptr = mallocFromArea(newMemoryArea, blockSize, alignment, zeroed);
+    unlockMemoryArea(newMemoryArea);
+    cache->homeArea = newMemoryArea;
+    return ptr;
+}
+
+void* customMTMalloc(size_t size){
+    if(TRACING()){
+        traceBegin();
+        void* ptr = customMTMalloc(size);
+        traceAllocated(TRACE_MT_MALLOC, size, ptr, 0);
+        return ptr;
+    }
+    if(size > largeAllocationThreshold){
+        return mallocLarge(size, MALLOC_ALIGNMENT);
+    }
+    size_t blockSize = blockSizeMT(size);
+    if(blockSize <= TCACHE_MAX_SIZE){
+        void* cached = tcacheGet(blockSize);
+        if(cached != NULL){
+            return cached;
+        }
+    }
+    return mallocFromAreas(blockSize, MALLOC_ALIGNMENT, NULL);
+}
+
+void* customMTAlignedAlloc(size_t alignment, size_t size){
+    if(TRACING()){
+        traceBegin();
+        void* ptr = customMTAlignedAlloc(alignment, size);
+        traceAllocated(TRACE_MT_ALIGNED_ALLOC, size, ptr, alignment);
+        return ptr;
+    }
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0){
+        ALLOCATOR_ERROR("<aligned alloc error>: alignment is not a power of two\n");
+        return NULL;
+    }
+    if(alignment <= MALLOC_ALIGNMENT){
+        return customMTMalloc(size);
+    }
+    if(size > largeAllocationThreshold || alignment > BLOCK_SIZE_MASK / 4){
+        if(alignment > PAGE_PROVIDER_ALIGNMENT){
+            ALLOCATOR_ERROR("<aligned alloc error>: alignment is too large\n");
+            return NULL;
+        }
+        return mallocLarge(size, alignment);
+    }
+    return mallocFromAreas(blockSizeMT(size), alignment, NULL);
+}
+
+size_t customMTMallocBatch(size_t size, size_t count, void** out){
+    if(TRACING()){
+        // logged as the single mallocs it stands for
+        traceBegin();
+        size_t done = customMTMallocBatch(size, count, out);
+        for(size_t i = 0; i < done; i++){
+            traceAllocated(TRACE_MT_MALLOC, size, out[i], 0);
+        }
+        threadTrace.busy = false;
+        return done;
+    }
+    size_t done = 0;
+    if(size > largeAllocationThreshold){
+        while(done < count && (out[done] = mallocLarge(size, MALLOC_ALIGNMENT)) != NULL){
+            done++;
+        }
+        return done;
+    }
+    size_t blockSize = blockSizeMT(size);
+    if(blockSize <= TCACHE_MAX_SIZE){
+        while(done < count && (out[done] = tcacheGet(blockSize)) != NULL){
+            done++;
+        }
+    }
+    ThreadCache* cache = getThreadCache();
+    while(done < count){
+        // as much as the home area holds under one lock
+        MemoryArea* homeArea = homeMemoryArea(cache);
+        if(homeArea != NULL){
+            lockMemoryArea(homeArea);
+            while(done < count && (out[done] = mallocFromArea(homeArea, blockSize, MALLOC_ALIGNMENT, NULL)) != NULL){
+                done++;
+            }
+            unlockMemoryArea(homeArea);
+        }
+        if(done == count){
+            break;
+        }
+        // home is full; the general path steals or adds an area, which may
+        // become the new home for the rest of the batch
+        out[done] = mallocFromAreas(blockSize, MALLOC_ALIGNMENT, NULL);
+        if(out[done] == NULL){
+            break;
+        }
+        done++;
+    }
+    return done;
+}
+
+#define FREE_BATCH_CHUNK (64) // pointers sorted and freed together
+
+static int comparePointers(const void* a, const void* b){
+    uintptr_t left = (uintptr_t)*(void* const*)a;
+    uintptr_t right = (uintptr_t)*(void* const*)b;
+    return left < right ? -1 : left > right;
+}
+
+// frees a run of blocks of one area sorted by address; the area must be
+// locked. neighbours come one after another, so merges stay local
+static void freeBlocksMT(MemoryArea* memoryArea, void** ptrs, size_t count){
+    for(size_t i = 0; i < count; i++){
+        BlockMT* block = findBlockMT(memoryArea, ptrs[i]);
+        if(block == NULL || (block->sizeWord & (MT_CACHED | MT_FREE)) != 0){
+            ALLOCATOR_ERROR("<free error>: passed non-heap pointer\n");
+            continue;
+        }
+        statsFreed(blockMTSize(block));
+        freeBlockMT(memoryArea, block);
+    }
+}
+
+void customMTFreeBatch(void** ptrs, size_t count){
+    if(TRACING()){
+        unsigned long long time = traceBegin();
+        customMTFreeBatch(ptrs, count);
+        for(size_t i = 0; i < count; i++){
+            traceFreed(TRACE_MT_FREE, time, ptrs[i]);
+        }
+        threadTrace.busy = false;
         return;
     }
-    block->free = true;
+    void* sorted[FREE_BATCH_CHUNK];
+    size_t next = 0;
+    while(next < count){
+        // large blocks and bad pointers go one by one, area blocks are
+        // collected and sorted so each area is locked once per chunk
+        size_t sortedCount = 0;
+        for(; next < count && sortedCount < FREE_BATCH_CHUNK; next++){
+            void* ptr = ptrs[next];
+            if(ptr == NULL){
+                ALLOCATOR_ERROR("<free error>: passed null pointer\n");
+                continue;
+            }
+            if(findMemoryArea(ptr) == NULL){
+                customMTFree(ptr);
+                continue;
+            }
+            sorted[sortedCount++] = ptr;
+        }
+        qsort(sorted, sortedCount, sizeof(void*), comparePointers);
+
+        size_t runStart = 0;
+        while(runStart < sortedCount){
+            MemoryArea* memoryArea = findMemoryArea(sorted[runStart]);
+            size_t runEnd = runStart + 1;
+            while(runEnd < sortedCount && findMemoryArea(sorted[runEnd]) == memoryArea){
+                runEnd++;
+            }
+            // a busy area gets the run through its remote free list instead
+            if(tryLockMemoryArea(memoryArea)){
+                freeBlocksMT(memoryArea, sorted + runStart, runEnd - runStart);
+                remoteFreeDrain(memoryArea);
+                unlockMemoryArea(memoryArea);
+            }else{
+                for(size_t i = runStart; i < runEnd; i++){
+                    BlockMT* block = findBlockMT(memoryArea, sorted[i]);
+                    if(block == NULL || (MT_SIZE_WORD_LOAD(sorted[i]) & (MT_CACHED | MT_FREE)) != 0){
+                        ALLOCATOR_ERROR("<free error>: passed non-heap pointer\n");
+                        continue;
+                    }
+                    statsFreed(blockMTSize(block));
+                    __atomic_fetch_or(&block->sizeWord, MT_CACHED, __ATOMIC_RELAXED);
+                    remoteFreePush(memoryArea, sorted[i]);
+                }
+            }
+            runStart = runEnd;
+        }
+    }
+}
+
+// O(1) and lock-free: areas own whole units of the address map
+MemoryArea* findMemoryArea(void* ptr){
+    return (MemoryArea*)addressMapFind(ptr, ADDRESS_MAP_AREA);
+}
+
+// O(1): the header sits right before the payload. ptr is only trusted if it
+// lies in the area and the header carries the tag of its address.
+BlockMT* findBlockMT(MemoryArea* memoryArea, void* ptr){
+    char* dataStart = (char*)memoryArea->dataPtr + sizeof(BlockMT);
+    char* dataEnd = (char*)memoryArea->dataPtr + memoryArea->size;
+    if((char*)ptr < dataStart || (char*)ptr >= dataEnd || ((uintptr_t)ptr & 7) != 0){
+        return NULL;
+    }
+    BlockMT* block = (BlockMT*)ptr - 1;
+    if((MT_SIZE_WORD_LOAD(ptr) & BLOCK_TAG_MASK) != BLOCK_TAG(ptr)){
+        return NULL;
+    }
+    return block;
+}
+
+// returns an allocated block to its area; the area must be locked. the
+// block stays MT_ZERO only when it has it and merges with no neighbour
+void freeBlockMT(MemoryArea* memoryArea, BlockMT* block){
+    size_t size = blockMTSize(block);
+    size_t zero = block->sizeWord & MT_ZERO;
 
     // 1) Coalesce with NEXT if free
-    if(block->next != NULL && block->next->free){
+    if(block->next != NULL && blockMTIsFree(block->next)){
         BlockMT* nextBlock = block->next;
-        block->size = block->size + nextBlock->size;
+        removeFreeBlockMT(memoryArea, nextBlock);
+        size += sizeof(BlockMT) + blockMTSize(nextBlock);
         block->next = nextBlock->next;
         if(block->next != NULL){
             block->next->prev = block;
         }
-        pthread_mutex_lock(&heapSizeModificationMutex);
-        customFree(nextBlock);
-        pthread_mutex_unlock(&heapSizeModificationMutex);
+        nextBlock->sizeWord = 0; // header is absorbed, stale pointers must not match
+        zero = 0;
     }
     // 2) Coalesce with PREV if free
-    if(block->prev != NULL && block->prev->free){
+    if(block->prev != NULL && blockMTIsFree(block->prev)){
         BlockMT* prevBlock = block->prev;
-        prevBlock->size = prevBlock->size + block->size;
+        removeFreeBlockMT(memoryArea, prevBlock);
+        size += sizeof(BlockMT) + blockMTSize(prevBlock);
         prevBlock->next = block->next;
         if(prevBlock->next != NULL){
             prevBlock->next->prev = prevBlock;
         }
-        pthread_mutex_lock(&heapSizeModificationMutex);
-        customFree(block);
-        pthread_mutex_unlock(&heapSizeModificationMutex);
+        block->sizeWord = 0;
+        block = prevBlock;
+        zero = 0;
     }
-    pthread_mutex_unlock(&memoryArea->mutex);
+    blockMTSetSizeWord(block, size, MT_FREE | zero);
+    insertFreeBlockMT(memoryArea, block);
 }
 
-void* customMTCalloc(size_t nmemb, size_t size){
-    void* ptr = customMTMalloc(nmemb * size);
+void customMTFree(void* ptr){
+    if(TRACING()){
+        unsigned long long time = traceBegin();
+        customMTFree(ptr);
+        traceFreed(TRACE_MT_FREE, time, ptr);
+        return;
+    }
     if(ptr == NULL){
+        ALLOCATOR_ERROR("<free error>: passed null pointer\n");
+        return;
+    }
+    if(tcachePut(ptr)){
+        return;
+    }
+    LargeBlock* large = findLargeBlock(ptr);
+    if(large != NULL){
+        freeLarge(large);
+        return;
+    }
+
+    MemoryArea* memoryArea = findMemoryArea(ptr);
+    if(memoryArea == NULL){
+        ALLOCATOR_ERROR("<free error>: passed non-heap pointer\n");
+        return;
+    }
+    BlockMT* block = findBlockMT(memoryArea, ptr);
+    if(block == NULL || (MT_SIZE_WORD_LOAD(ptr) & (MT_CACHED | MT_FREE)) != 0){
+        ALLOCATOR_ERROR("<free error>: passed non-heap pointer\n");
+        return;
+    }
+    statsFreed(blockMTSize(block));
+    // the block is allocated, so nobody else touches its header until it is
+    // back in the area
+    if(isForeignArea(getThreadCache(), memoryArea)){
+        __atomic_fetch_or(&block->sizeWord, MT_CACHED, __ATOMIC_RELAXED);
+        remoteFreePush(memoryArea, ptr);
+        return;
+    }
+    lockMemoryArea(memoryArea);
+    freeBlockMT(memoryArea, block);
+    remoteFreeDrain(memoryArea);
+    unlockMemoryArea(memoryArea);
+}
+
+void* customMTCalloc(size_t nmemb, size_t size){
+    if(TRACING()){
+        traceBegin();
+        void* ptr = customMTCalloc(nmemb, size);
+        traceAllocated(TRACE_MT_CALLOC, size, ptr, nmemb);
+        return ptr;
+    }
+    size_t total;
+    if(__builtin_mul_overflow(nmemb, size, &total)){
+        ALLOCATOR_ERROR("<calloc error>: requested size is too large\n");
         return NULL;
     }
-    memset(ptr, 0, nmemb * size);
+    // a large block is a fresh mapping, already zero
+    if(total > largeAllocationThreshold){
+        return mallocLarge(total, MALLOC_ALIGNMENT);
+    }
+    size_t blockSize = blockSizeMT(total);
+    void* ptr = blockSize <= TCACHE_MAX_SIZE ? tcacheGet(blockSize) : NULL;
+    bool zeroed = false;
+    if(ptr == NULL){
+        ptr = mallocFromAreas(blockSize, MALLOC_ALIGNMENT, &zeroed);
+        if(ptr == NULL){
+            return NULL;
+        }
+    }
+    if(!zeroed){
+        memset(ptr, 0, total);
+    }
     return ptr;
 }
 
 void* customMTRealloc(void* ptr, size_t size){
+    if(TRACING()){
+        unsigned long long time = traceBegin();
+        void* newPtr = customMTRealloc(ptr, size);
+        traceReallocated(TRACE_MT_REALLOC, TRACE_MT_REALLOC_RETURN, time, size, newPtr, ptr);
+        return newPtr;
+    }
     if(ptr == NULL){
         return customMTMalloc(size);
     }
-
-    pthread_mutex_lock(&memoryAreaListMutex);
-    if(memoryAreaList == NULL){
-        printf("<realloc error>: passed non-heap pointer\n");
-        pthread_mutex_unlock(&memoryAreaListMutex);
-        return NULL;
+    LargeBlock* large = findLargeBlock(ptr);
+    if(large != NULL){
+        if(size > largeAllocationThreshold){
+            return reallocLarge(large, size);
+        }
+        // back below the threshold: move into an area and drop the mapping
+        void* newPtr = customMTMalloc(size);
+        if(newPtr == NULL){
+            return NULL;
+        }
+        memcpy(newPtr, ptr, size);
+        freeLarge(large);
+        return newPtr;
     }
+
     MemoryArea* memoryArea = findMemoryArea(ptr);
     if(memoryArea == NULL){
-        printf("<realloc error>: passed non-heap pointer\n");
-        pthread_mutex_unlock(&memoryAreaListMutex);
+        ALLOCATOR_ERROR("<realloc error>: passed non-heap pointer\n");
         return NULL;
     }
-    pthread_mutex_lock(&memoryArea->mutex);
-
     BlockMT* block = findBlockMT(memoryArea, ptr);
-    if(block == NULL){
-        printf("<realloc error>: passed non-heap pointer\n");
-        pthread_mutex_unlock(&memoryArea->mutex);
-        pthread_mutex_unlock(&memoryAreaListMutex);
-        return NULL;
-    }
-    if(block->free){
-        printf("<realloc error>: passed non-heap pointer\n");
-        pthread_mutex_unlock(&memoryArea->mutex);
-        pthread_mutex_unlock(&memoryAreaListMutex);
+    if(block == NULL || (MT_SIZE_WORD_LOAD(ptr) & (MT_CACHED | MT_FREE)) != 0){
+        ALLOCATOR_ERROR("<realloc error>: passed non-heap pointer\n");
         return NULL;
     }
 
-    size_t newSize = ALIGN_TO_MULT_OF_4(size);
+    size_t newSize = blockSizeMT(size);
+    size_t oldSize = blockMTSize(block);
     // Realloc to the same size
-    if(block->size == newSize){
-        pthread_mutex_unlock(&memoryArea->mutex);
-        pthread_mutex_unlock(&memoryAreaListMutex);
+    if(oldSize == newSize){
         return ptr;
     }
 
-    // Realloc to larger size
-    if(block->size < newSize){
+    // Realloc to larger size; first try to take over a free successor
+    if(oldSize < newSize && newSize <= largeAllocationThreshold){
+        lockMemoryArea(memoryArea);
+        remoteFreeDrain(memoryArea);
+        BlockMT* nextBlock = block->next;
+        if(nextBlock != NULL && blockMTIsFree(nextBlock) &&
+           oldSize + sizeof(BlockMT) + blockMTSize(nextBlock) >= newSize){
+            removeFreeBlockMT(memoryArea, nextBlock);
+            block->next = nextBlock->next;
+            if(block->next != NULL){
+                block->next->prev = block;
+            }
+            blockMTSetSizeWord(block, oldSize + sizeof(BlockMT) + blockMTSize(nextBlock), 0);
+            nextBlock->sizeWord = 0; // header is absorbed, stale pointers must not match
+            splitBlockMT(memoryArea, block, newSize);
+            statsResized(oldSize, blockMTSize(block));
+            unlockMemoryArea(memoryArea);
+            return ptr;
+        }
+        unlockMemoryArea(memoryArea);
+    }
+    // otherwise move it; the caller owns the block, so it can be copied
+    // without holding the area
+    if(oldSize < newSize){
         void* newPtr = customMTMalloc(newSize);
         if(newPtr == NULL){
-            pthread_mutex_unlock(&memoryArea->mutex);
-            pthread_mutex_unlock(&memoryAreaListMutex);
             return NULL;
         }
-        memcpy(newPtr, ptr, block->size);
-            customMTFree(ptr);
-        pthread_mutex_unlock(&memoryArea->mutex);
-        pthread_mutex_unlock(&memoryAreaListMutex);
+        memcpy(newPtr, ptr, oldSize);
+        customMTFree(ptr);
         return newPtr;
     }
 
     // Realloc to smaller size; split the block into two blocks
-    pthread_mutex_unlock(&memoryAreaListMutex);
+    lockMemoryArea(memoryArea);
+    splitBlockMT(memoryArea, block, newSize);
+    statsResized(oldSize, blockMTSize(block));
+    unlockMemoryArea(memoryArea);
+    return ptr;
+}
 
-    pthread_mutex_lock(&heapSizeModificationMutex);
-    BlockMT* newBlock = (BlockMT*)customMalloc(sizeof(BlockMT));
-    pthread_mutex_unlock(&heapSizeModificationMutex);
-    if(newBlock == NULL){
+bool customOwnsAddress(void* ptr){
+    return addressMapGet(ptr) != 0;
+}
+
+size_t customMTUsableSize(void* ptr){
+    if(ptr == NULL){
+        return 0;
+    }
+    LargeBlock* large = findLargeBlock(ptr);
+    if(large != NULL){
+        return large->sizeWord & BLOCK_SIZE_MASK;
+    }
+    MemoryArea* memoryArea = findMemoryArea(ptr);
+    if(memoryArea == NULL){
+        return 0;
+    }
+    BlockMT* block = findBlockMT(memoryArea, ptr);
+    if(block == NULL || (MT_SIZE_WORD_LOAD(ptr) & (MT_CACHED | MT_FREE)) != 0){
+        return 0;
+    }
+    return blockMTSize(block);
+}
+
+// largest free payload of an area, found in its highest non-empty class;
+// the area must be locked
+static size_t largestFreeBlockMT(MemoryArea* memoryArea){
+    size_t largest = 0;
+    for(size_t word = SIZE_CLASS_BITMAP_WORDS; word > 0 && largest == 0; word--){
+        unsigned long long bits = memoryArea->freeListBitmap[word - 1];
+        if(bits == 0){
+            continue;
+        }
+        size_t cls = (word - 1) * 64 + 63 - (size_t)__builtin_clzll(bits);
+        for(BlockMT* current = memoryArea->freeLists[cls]; current != NULL; current = MT_FREE_LINKS(current)->nextFree){
+            if(blockMTSize(current) > largest){
+                largest = blockMTSize(current);
+            }
+        }
+    }
+    return largest;
+}
+
+MallocStats customMTMallocStats(){
+    MallocStats stats;
+    memset(&stats, 0, sizeof(MallocStats));
+    ThreadStats total;
+    memset(&total, 0, sizeof(ThreadStats));
+    pthread_mutex_lock(&threadStatsMutex);
+    threadStatsFold(&total, &retiredStats);
+    for(ThreadStats* current = threadStatsList; current != NULL; current = current->next){
+        threadStatsFold(&total, current);
+    }
+    pthread_mutex_unlock(&threadStatsMutex);
+    stats.bytesInUse = atomic_load(&total.bytesAllocated) - atomic_load(&total.bytesFreed);
+    stats.allocatedBlocks = atomic_load(&total.blocksAllocated) - atomic_load(&total.blocksFreed);
+    stats.lockContentions = atomic_load(&total.lockContentions);
+
+    for(MemoryArea* memoryArea = __atomic_load_n(&memoryAreaList, __ATOMIC_ACQUIRE); memoryArea != NULL;
+        memoryArea = __atomic_load_n(&memoryArea->next, __ATOMIC_ACQUIRE)){
+        pthread_mutex_lock(&memoryArea->mutex);
+        remoteFreeDrain(memoryArea);
+        stats.bytesFree += memoryArea->freeBytes;
+        stats.freeBlocks += memoryArea->freeBlockCount;
+        size_t largest = largestFreeBlockMT(memoryArea);
         pthread_mutex_unlock(&memoryArea->mutex);
+        if(largest > stats.largestFreeBlock){
+            stats.largestFreeBlock = largest;
+        }
+        stats.areaCount++;
+    }
+    stats.heapBytes = atomic_load(&mappedBytesMT);
+    stats.peakHeapBytes = atomic_load(&peakMappedBytesMT);
+    stats.fragmentation = fragmentation(stats.largestFreeBlock, stats.bytesFree);
+    return stats;
+}
+
+size_t customMTAreaStats(AreaStats* out, size_t capacity){
+    size_t count = 0;
+    for(MemoryArea* memoryArea = __atomic_load_n(&memoryAreaList, __ATOMIC_ACQUIRE); memoryArea != NULL;
+        memoryArea = __atomic_load_n(&memoryArea->next, __ATOMIC_ACQUIRE)){
+        if(count < capacity){
+            pthread_mutex_lock(&memoryArea->mutex);
+            remoteFreeDrain(memoryArea);
+            out[count].size = memoryArea->size;
+            out[count].bytesFree = memoryArea->freeBytes;
+            out[count].freeBlocks = memoryArea->freeBlockCount;
+            out[count].largestFreeBlock = largestFreeBlockMT(memoryArea);
+            pthread_mutex_unlock(&memoryArea->mutex);
+            out[count].lockContentions = __atomic_load_n(&memoryArea->lockContentions, __ATOMIC_RELAXED);
+        }
+        count++;
+    }
+    return count;
+}
+
+/*=============================================================================
+* slabs
+* a slab hands out fixed-size slots from chunks of its own mapped from the
+* page provider and registered in the address map, so a slot needs no
+* header. the owner pops from a private free list, then from slots never
+* used; other threads free through remoteFreeList with a CAS, which the
+* owner takes over whenever its own list runs dry.
+=============================================================================*/
+#define SLAB_CHUNK_SIZE (PAGE_PROVIDER_ALIGNMENT)
+#define SLAB_MIN_SLOTS (8) // a chunk holds at least this many objects
+
+typedef struct SlabChunk
+{
+    struct SlabChunk* next;
+    Slab* slab;
+    size_t mapSize;
+    char* slots; // first slot, MALLOC_ALIGNMENT aligned
+    char* slotsEnd;
+} SlabChunk;
+
+struct Slab
+{
+    size_t slotSize;
+    pthread_t owner;
+    TCacheEntry* freeList; // owner only
+    TCacheEntry* remoteFreeList; // pushed by other threads
+    SlabChunk* chunks; // newest first; the slab itself lives in the last one
+    char* unusedSlots; // never handed out slots of the newest chunk
+};
+
+#define SLAB_CHUNK_HEADER_SIZE (ALIGN_TO_MULT_OF_16(sizeof(SlabChunk)))
+
+// maps a chunk with room for `reserved` bytes after its header and at least
+// SLAB_MIN_SLOTS slots of slotSize. the slab field is left to the caller
+static SlabChunk* createSlabChunk(size_t slotSize, size_t reserved){
+    size_t minSize = SLAB_CHUNK_HEADER_SIZE + reserved + slotSize * SLAB_MIN_SLOTS;
+    size_t mapSize = (minSize + SLAB_CHUNK_SIZE - 1) & ~(size_t)(SLAB_CHUNK_SIZE - 1);
+    SlabChunk* chunk = (SlabChunk*)pageProvider.map(mapSize);
+    if(chunk == NULL){
+        return NULL;
+    }
+    if(!addressMapSet(chunk, mapSize, (uintptr_t)chunk | ADDRESS_MAP_SLAB)){
+        pageProvider.unmap(chunk, mapSize);
         return NULL;
     }
-    block->size = newSize;
-    newBlock->size = block->size - newSize;
-    newBlock->dataPtr = (void*)((char*)block->dataPtr + newSize);
+    chunk->next = NULL;
+    chunk->mapSize = mapSize;
+    chunk->slots = (char*)chunk + SLAB_CHUNK_HEADER_SIZE + reserved;
+    chunk->slotsEnd = chunk->slots + (mapSize - SLAB_CHUNK_HEADER_SIZE - reserved) / slotSize * slotSize;
+    return chunk;
+}
 
-    newBlock->prev = block;
-    newBlock->next = block->next;
-    block->next = newBlock;
-    if (newBlock->next != NULL){
-        newBlock->next->prev = newBlock;
+static void releaseSlabChunk(SlabChunk* chunk){
+    addressMapSet(chunk, chunk->mapSize, 0);
+    pageProvider.unmap(chunk, chunk->mapSize);
+}
+
+Slab* slabCreate(size_t objSize){
+    if(objSize > BLOCK_SIZE_MASK / (2 * SLAB_MIN_SLOTS)){
+        ALLOCATOR_ERROR("<slab error>: object size is too large\n");
+        return NULL;
+    }
+    // slots hold the free list link while free and keep the default alignment
+    size_t slotSize = ALIGN_TO_MULT_OF_16(objSize < sizeof(TCacheEntry) ? sizeof(TCacheEntry) : objSize);
+    size_t reserved = ALIGN_TO_MULT_OF_16(sizeof(Slab));
+    SlabChunk* chunk = createSlabChunk(slotSize, reserved);
+    if(chunk == NULL){
+        return NULL;
+    }
+    Slab* slab = (Slab*)((char*)chunk + SLAB_CHUNK_HEADER_SIZE);
+    slab->slotSize = slotSize;
+    slab->owner = pthread_self();
+    slab->freeList = NULL;
+    slab->remoteFreeList = NULL;
+    slab->chunks = chunk;
+    slab->unusedSlots = chunk->slots;
+    chunk->slab = slab;
+    return slab;
+}
+
+void* slabAlloc(Slab* slab){
+    TCacheEntry* entry = slab->freeList;
+    if(entry == NULL && __atomic_load_n(&slab->remoteFreeList, __ATOMIC_RELAXED) != NULL){
+        entry = __atomic_exchange_n(&slab->remoteFreeList, NULL, __ATOMIC_ACQUIRE);
+    }
+    if(entry != NULL){
+        slab->freeList = entry->next;
+        return (void*)entry;
     }
-    pthread_mutex_unlock(&memoryArea->mutex);
+    if(slab->unusedSlots == slab->chunks->slotsEnd){
+        SlabChunk* chunk = createSlabChunk(slab->slotSize, 0);
+        if(chunk == NULL){
+            return NULL;
+        }
+        chunk->slab = slab;
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->unusedSlots = chunk->slots;
+    }
+    void* ptr = slab->unusedSlots;
+    slab->unusedSlots += slab->slotSize;
     return ptr;
-}
\ No newline at end of file
+}
+
+void slabFree(Slab* slab, void* ptr){
+    if(ptr == NULL){
+        ALLOCATOR_ERROR("<slab free error>: passed null pointer\n");
+        return;
+    }
+    // the chunk is found without touching ptr; the slot must be one of its own
+    SlabChunk* chunk = (SlabChunk*)addressMapFind(ptr, ADDRESS_MAP_SLAB);
+    if(chunk == NULL || chunk->slab != slab || (char*)ptr < chunk->slots || (char*)ptr >= chunk->slotsEnd ||
+       (size_t)((char*)ptr - chunk->slots) % slab->slotSize != 0){
+        ALLOCATOR_ERROR("<slab free error>: passed non-slab pointer\n");
+        return;
+    }
+    TCacheEntry* entry = (TCacheEntry*)ptr;
+    if(pthread_equal(pthread_self(), slab->owner)){
+        entry->next = slab->freeList;
+        slab->freeList = entry;
+        return;
+    }
+    TCacheEntry* head = __atomic_load_n(&slab->remoteFreeList, __ATOMIC_RELAXED);
+    do{
+        entry->next = head;
+    }while(!__atomic_compare_exchange_n(&slab->remoteFreeList, &head, entry,
+                                        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// releases every chunk, objects still allocated included
+void slabDestroy(Slab* slab){
+    SlabChunk* chunk = slab->chunks;
+    while(chunk != NULL){
+        // the slab lives in its last chunk, so read the link first
+        SlabChunk* next = chunk->next;
+        releaseSlabChunk(chunk);
+        chunk = next;
+    }
+}
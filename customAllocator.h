@@ -29,40 +29,251 @@ void heapKill();
 * do no edit lines above!
 =============================================================================*/
 
+// Part B - heap configuration
+typedef enum AreaGrowthPolicy
+{
+    AREA_GROWTH_FIXED, // every new area has areaSize bytes
+    AREA_GROWTH_GEOMETRIC // each new area is growthFactor times the previous one
+} AreaGrowthPolicy;
+
+typedef struct HeapConfig
+{
+    size_t initialAreaCount;
+    size_t areaSize; // usable bytes of each initial area, mapped in whole PAGE_PROVIDER_ALIGNMENT units
+    AreaGrowthPolicy growth;
+    size_t growthFactor; // AREA_GROWTH_GEOMETRIC only
+    size_t maxAreaSize; // cap for geometric growth
+    size_t areaRounding; // area sizes are rounded up to a multiple of this, 0 = off
+    size_t largeThreshold; // requests above it get their own mapping, 0 = areaSize or 128 KB, the larger
+} HeapConfig;
+
+// defaults, overridden by the CUSTOM_ALLOCATOR_* environment variables
+void heapDefaultConfig(HeapConfig* config);
+// heapCreate() is heapCreateWithConfig(NULL)
+void heapCreateWithConfig(const HeapConfig* config);
+
+// Part B - requests above the threshold get their own mapping. heapCreate
+// resets it from the config, so call it afterwards
+void customMTSetLargeThreshold(size_t threshold);
+
+// Both heaps - payload aligned to `alignment`, a power of two. every other
+// allocation is MALLOC_ALIGNMENT aligned. the MT heap's own mappings support
+// alignments up to PAGE_PROVIDER_ALIGNMENT
+void* customAlignedAlloc(size_t alignment, size_t size);
+void* customMTAlignedAlloc(size_t alignment, size_t size);
+
+// Part A - regions: bump allocation from chunks of the single thread heap,
+// everything released at once. regionReset keeps the chunks for reuse
+typedef struct Region Region;
+Region* regionCreate(size_t initialSize);
+void* regionAlloc(Region* region, size_t size);
+void regionReset(Region* region);
+void regionDestroy(Region* region);
+
+// Part B - allocate or free many blocks taking each lock once per batch.
+// customMTMallocBatch returns how many of the count blocks it allocated
+size_t customMTMallocBatch(size_t size, size_t count, void** out);
+void customMTFreeBatch(void** ptrs, size_t count);
+
+// Part B - pools of equal-sized objects with no per-object header. a slab
+// belongs to the thread that created it: only that thread may slabAlloc or
+// slabDestroy, while any thread may slabFree into it
+typedef struct Slab Slab;
+Slab* slabCreate(size_t objSize);
+void* slabAlloc(Slab* slab);
+void slabFree(Slab* slab, void* ptr);
+void slabDestroy(Slab* slab);
+
+// Part B - payload bytes usable at ptr, at least the size asked for; 0 when
+// ptr is not an allocated block of the MT heap
+size_t customMTUsableSize(void* ptr);
+
+// Both heaps - true when ptr lies in memory the allocator mapped for blocks
+// (a segment, area, large block or slab chunk), live block or not
+bool customOwnsAddress(void* ptr);
+
+// Part B - pthread_atfork handlers keeping the MT heap usable in a child
+// forked while other threads allocate. register them after heapCreate:
+// pthread_atfork(customMTForkPrepare, customMTForkParent, customMTForkChild)
+void customMTForkPrepare();
+void customMTForkParent();
+void customMTForkChild();
+
+// Both heaps - a snapshot of what the heap holds. the counters are kept as
+// the heap runs; customMTMallocStats sums the per-thread counters and locks
+// each area in turn, so it is only as consistent as a moving heap allows.
+// blocks sitting in MT thread caches are free to the user but in use to
+// their area. Part A never contends for a lock
+typedef struct MallocStats
+{
+    size_t heapBytes; // mapped from the page provider
+    size_t peakHeapBytes; // high-water mark of heapBytes, the old sbrk break
+    size_t bytesInUse; // allocated blocks
+    size_t bytesFree; // free blocks
+    size_t allocatedBlocks;
+    size_t freeBlocks;
+    size_t largestFreeBlock;
+    double fragmentation; // 1 - largestFreeBlock / bytesFree
+    size_t lockContentions; // area lock acquisitions that had to wait
+    size_t areaCount;
+} MallocStats;
+MallocStats customMallocStats();
+MallocStats customMTMallocStats();
+
+typedef struct AreaStats
+{
+    size_t size;
+    size_t bytesFree;
+    size_t freeBlocks;
+    size_t largestFreeBlock;
+    size_t lockContentions;
+} AreaStats;
+// fills at most capacity entries in list order, returns the number of areas
+size_t customMTAreaStats(AreaStats* out, size_t capacity);
+
+// Part B - lock profiling for the global mutexes and every area mutex:
+// acquisitions, waits by power of two nanoseconds and hold times. off until
+// enabled, when it costs a flag check per lock; building with
+// -DCUSTOM_ALLOCATOR_NO_LOCK_PROFILE compiles it out altogether
+void customLockProfileEnable(bool enable);
+void customLockProfileReset();
+void customLockProfileDump();
+
+// Both heaps - tracing. while a trace is on, every call to the malloc, free,
+// calloc, realloc and aligned alloc functions of either heap, batches
+// included, is logged with a timestamp, thread, size and pointers. records
+// are buffered per thread and appended to the file as buffers fill; stop
+// the trace only once the traced threads are done with the heap. the file
+// is a TraceFileHeader followed by TraceRecords, replayed by `make replay`.
+// a realloc is two records: TRACE_REALLOC gives up the old pointer when the
+// call begins, TRACE_REALLOC_RETURN hands out the new one when it returns
+typedef enum TraceOp
+{
+    TRACE_MALLOC,
+    TRACE_FREE,
+    TRACE_CALLOC,
+    TRACE_REALLOC,
+    TRACE_ALIGNED_ALLOC,
+    TRACE_MT_MALLOC,
+    TRACE_MT_FREE,
+    TRACE_MT_CALLOC,
+    TRACE_MT_REALLOC,
+    TRACE_MT_ALIGNED_ALLOC,
+    TRACE_REALLOC_RETURN,
+    TRACE_MT_REALLOC_RETURN
+} TraceOp;
+
+#define TRACE_MAGIC "CATRACE"
+#define TRACE_VERSION (2)
+
+typedef struct TraceFileHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int recordSize;
+} TraceFileHeader;
+
+typedef struct TraceRecord
+{
+    unsigned long long time; // ns, CLOCK_MONOTONIC; when a free or realloc began, or when anything else returned
+    unsigned long long size; // requested bytes; per element for calloc
+    unsigned long long ptr; // pointer returned, or freed
+    unsigned long long arg; // realloc and its return: old pointer, calloc: nmemb, aligned alloc: alignment
+    unsigned int thread; // small id given to each thread on its first record
+    unsigned int op; // TraceOp
+} TraceRecord;
+
+// returns false when a trace is already on or the file cannot be created
+bool customTraceStart(const char* path);
+void customTraceStop();
+
+// Both heaps - where memory comes from. map() gets a multiple of the page
+// size and returns that many zeroed bytes aligned to PAGE_PROVIDER_ALIGNMENT,
+// or NULL when out of memory; calloc relies on fresh memory reading as zero.
+// purge() keeps the range mapped but lets the OS drop its pages. remap() may
+// be NULL, large blocks are then resized by copying; when it moves a mapping
+// the new one must be PAGE_PROVIDER_ALIGNMENT aligned too.
+// Install a provider before the first allocation; NULL restores the default
+// anonymous mmap provider.
+typedef struct PageProvider
+{
+    void* (*map)(size_t size);
+    void (*unmap)(void* ptr, size_t size);
+    void (*purge)(void* ptr, size_t size);
+    void* (*remap)(void* ptr, size_t oldSize, size_t newSize);
+} PageProvider;
+void customSetPageProvider(const PageProvider* provider);
+
 /*=============================================================================
 * defines
 =============================================================================*/
-#define SBRK_FAIL (void*)(-1)
+#define PAGE_PROVIDER_ALIGNMENT (64 * 1024)
+#define MALLOC_ALIGNMENT (16)
 #define ALIGN_TO_MULT_OF_4(x) (((((x) - 1) >> 2) << 2) + 4)
+#define ALIGN_TO_MULT_OF_16(x) (((x) + 15) & ~(size_t)15)
 
 /*=============================================================================
 * Block
 =============================================================================*/
-//suggestion for block usage - feel free to change this
+// header of a single thread heap block. only `header` is stored for
+// allocated blocks; the free list links overlay the payload of free blocks.
+// see "block format" in customAllocator.c
 typedef struct Block
 {
-    size_t size; // in bytes
-    struct Block* next;
-    struct Block* prev;
-    bool free;
+    size_t header; // tag | size in bytes (header included) | flags
+    struct Block* nextFree; // free blocks only
+    struct Block* prevFree; // free blocks only
 } Block;
-extern Block* blockList;
 
+// a chunk obtained from the page provider, carved into Blocks and closed by
+// a zero-size epilogue header
+typedef struct Segment
+{
+    size_t size; // bytes mapped, this header included
+    struct Segment* next;
+    struct Segment* prev;
+} Segment;
+extern Segment* segmentList;
+
+// header of a multi thread heap block, stored inline in its area's data
+// right before the payload
 typedef struct BlockMT
 {
-    size_t size; // in bytes
-    struct BlockMT* next;
+    struct BlockMT* next; // neighbours in address order
     struct BlockMT* prev;
-    bool free;
-    void* dataPtr;
+    size_t reserved; // pads the header so payloads stay MALLOC_ALIGNMENT aligned
+    size_t sizeWord; // tag | payload size in bytes | flags
 } BlockMT;
 
+#define AREA_SIZE_CLASSES (88) // same classes as the single thread heap
+#define LOCK_PROFILE_BUCKETS (32)
+
+// what one mutex went through while lock profiling was on
+typedef struct LockProfile
+{
+    size_t acquisitions;
+    size_t contended; // acquisitions that waited, and failed trylocks
+    size_t waitNs;
+    size_t holdNs;
+    size_t maxHoldNs;
+    size_t waitHistogram[LOCK_PROFILE_BUCKETS]; // bucket i: waits below 2^i ns
+    size_t depth; // recursive acquisitions by the holder
+    unsigned long long acquiredAt;
+} LockProfile;
+
 typedef struct MemoryArea
 {
     size_t size;
     pthread_mutex_t mutex;
     void* dataPtr;
     BlockMT* blockList;
+    BlockMT* freeLists[AREA_SIZE_CLASSES]; // free blocks by payload size class
+    unsigned long long freeListBitmap[(AREA_SIZE_CLASSES + 63) / 64]; // non-empty classes
+    void* remoteFreeList; // blocks freed by other threads, pushed with a CAS
+    size_t freeBytes; // payload bytes of the free blocks
+    size_t freeBlockCount;
+    size_t lockContentions; // lockMemoryArea calls that had to wait
+    LockProfile lockProfile;
     struct MemoryArea* next;
 } MemoryArea;
 extern MemoryArea* memoryAreaList;
@@ -5,6 +5,9 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h> //for uintptr_t
+#include <sys/wait.h> //for waitpid
+#include <stdatomic.h>
 
 void test_malloc_free_1() {
   void* heapStart = sbrk(0);
@@ -135,6 +138,59 @@ void test_calloc(){
   printf("ptr1: %p\n", ptr1);
 }
 
+static int isZero(const unsigned char* ptr, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (ptr[i] != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// calloc skips the memset for fresh memory, so recycled memory must still
+// come back cleared, and nmemb * size must not wrap
+void test_calloc_zeroing(){
+  printf("==== test_calloc_zeroing ====\n");
+  size_t sizes[] = {24, 1000, 200000};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    unsigned char* dirty = (unsigned char*)customMalloc(sizes[i]);
+    memset(dirty, 0xff, sizes[i]);
+    customFree(dirty);
+    unsigned char* ptr = (unsigned char*)customCalloc(1, sizes[i]);
+    printf("Part A calloc(%zu) after reuse is zero: %s\n", sizes[i], isZero(ptr, sizes[i]) ? "yes" : "no");
+    customFree(ptr);
+  }
+  printf("Part A calloc overflow returns NULL: %s\n", customCalloc(SIZE_MAX / 2, 3) == NULL ? "yes" : "no");
+
+  heapCreate();
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    unsigned char* dirty = (unsigned char*)customMTMalloc(sizes[i]);
+    memset(dirty, 0xff, sizes[i]);
+    customMTFree(dirty);
+    unsigned char* ptr = (unsigned char*)customMTCalloc(sizes[i], 1);
+    printf("Part B calloc(%zu) after reuse is zero: %s\n", sizes[i], isZero(ptr, sizes[i]) ? "yes" : "no");
+    customMTFree(ptr);
+  }
+  printf("Part B calloc overflow returns NULL: %s\n", customMTCalloc(SIZE_MAX / 2, 3) == NULL ? "yes" : "no");
+  heapKill();
+}
+
+// free must reject pointers that are not block starts without scanning the heap
+void test_free_invalid_pointer(){
+  printf("==== test_free_invalid_pointer ====\n");
+  int onStack = 0;
+  char* ptr1 = (char*)customMalloc(32);
+  char* ptr2 = (char*)customMalloc(32);
+  if(ptr1 == NULL || ptr2 == NULL){
+      printf("malloc failed\n");
+      return;
+  }
+  customFree(&onStack);   // expected: <free error>: passed non-heap pointer
+  customFree(ptr1 + 8);   // expected: <free error>: passed non-heap pointer
+  customFree(ptr1);
+  customFree(ptr2);
+}
+
 // genreate  function tests for realloc:
 // 1. samity
 // 2. create a few blocks and shrink the last block
@@ -237,6 +293,21 @@ void test_realloc_extend_middle_block() {
   customFree(p3);
 }
 
+// Extend a middle block whose successor is free; it grows in place
+void test_realloc_extend_into_free_successor() {
+  printf("==== test_realloc_extend_into_free_successor ====\n");
+  void* p1 = customMalloc(24);
+  void* p2 = customMalloc(128);
+  void* p3 = customMalloc(32);
+
+  customFree(p2);
+  void* p1_extended = customRealloc(p1, 96);
+  printf("p1(original): %p, p1(extended): %p, grown in place: %s\n", p1, p1_extended, p1 == p1_extended ? "yes" : "no");
+
+  customFree(p1_extended);
+  customFree(p3);
+}
+
 // 5. Extend last block
 void test_realloc_extend_last_block() {
   printf("==== test_realloc_extend_last_block ====\n");
@@ -291,6 +362,399 @@ void test_single_thread_realloc() {
 }
 
 
+// requests above the large threshold are mapped on their own and resized with mremap
+void test_single_thread_large() {
+    heapCreate();
+
+    char* ptr = (char*)customMTMalloc(256 * 1024);
+    printf("Allocated large %p\n", (void*)ptr);
+    memset(ptr, 7, 256 * 1024);
+
+    char* ptr2 = (char*)customMTRealloc(ptr, 1024 * 1024);
+    printf("Reallocated large %p, data kept: %s\n", (void*)ptr2, ptr2[256 * 1024 - 1] == 7 ? "yes" : "no");
+    memset(ptr2, 8, 1024 * 1024);
+
+    char* ptr3 = (char*)customMTRealloc(ptr2, 512);
+    printf("Reallocated small %p, data kept: %s\n", (void*)ptr3, ptr3[511] == 8 ? "yes" : "no");
+
+    customMTFree(ptr3);
+    printf("Freed %p\n", (void*)ptr3);
+    heapKill();
+}
+
+void test_region() {
+    printf("==== test_region ====\n");
+    Region* region = regionCreate(1024);
+    char* first = regionAlloc(region, 10);
+    char* second = regionAlloc(region, 10);
+    printf("first: %p, second: %p, second - first = %zu\n", (void*)first, (void*)second, (size_t)(second - first));
+    for (int i = 0; i < 1000; i++) {
+        memset(regionAlloc(region, 100), i, 100);
+    }
+    char* big = regionAlloc(region, 100000);
+    memset(big, 1, 100000);
+
+    // after a reset the same chunks are handed out again
+    regionReset(region);
+    char* again = regionAlloc(region, 10);
+    printf("after reset: %p, same as first: %s\n", (void*)again, again == first ? "yes" : "no");
+
+    // sizes that would wrap around when aligned are refused
+    char* huge = regionAlloc(region, SIZE_MAX);
+    char* after = regionAlloc(region, 10);
+    printf("huge alloc returns NULL: %s, next alloc moves on: %s\n", huge == NULL ? "yes" : "no",
+           after != again ? "yes" : "no");
+    printf("huge region returns NULL: %s\n", regionCreate(SIZE_MAX) == NULL ? "yes" : "no");
+    regionDestroy(region);
+}
+
+void test_aligned_alloc() {
+    printf("==== test_aligned_alloc ====\n");
+    void* plain = customMalloc(24);
+    void* line = customAlignedAlloc(64, 100);
+    void* page = customAlignedAlloc(4096, 5000);
+    void* bad = customAlignedAlloc(48, 100);
+    printf("plain %% 16 = %zu, line %% 64 = %zu, page %% 4096 = %zu, bad = %p\n",
+           (size_t)((uintptr_t)plain % 16), (size_t)((uintptr_t)line % 64), (size_t)((uintptr_t)page % 4096), bad);
+    customFree(plain);
+    customFree(line);
+    customFree(page);
+
+    heapCreate();
+    void* mtLine = customMTAlignedAlloc(64, 100);
+    void* mtPage = customMTAlignedAlloc(4096, 100000);
+    printf("mt line %% 64 = %zu, mt page %% 4096 = %zu\n",
+           (size_t)((uintptr_t)mtLine % 64), (size_t)((uintptr_t)mtPage % 4096));
+    customMTFree(mtLine);
+    customMTFree(mtPage);
+    heapKill();
+}
+
+typedef struct {
+  Slab* slab;
+  void** objects;
+  int count;
+} slab_free_arg_t;
+
+void* slab_free_worker(void* p) {
+  slab_free_arg_t* a = (slab_free_arg_t*)p;
+  for (int i = 0; i < a->count; i++) {
+    slabFree(a->slab, a->objects[i]);
+  }
+  return NULL;
+}
+
+void test_slab() {
+    printf("==== test_slab ====\n");
+    Slab* slab = slabCreate(40);
+    void* objects[2000];
+    for (int i = 0; i < 2000; i++) {
+        objects[i] = slabAlloc(slab);
+        memset(objects[i], i, 40);
+    }
+    printf("first: %p, second: %p, last: %p\n", objects[0], objects[1], objects[1999]);
+
+    // half freed here, half by another thread
+    for (int i = 0; i < 1000; i++) {
+        slabFree(slab, objects[i]);
+    }
+    slab_free_arg_t arg = {slab, objects + 1000, 1000};
+    pthread_t th;
+    pthread_create(&th, NULL, slab_free_worker, &arg);
+    pthread_join(th, NULL);
+
+    int reused = 0;
+    for (int i = 0; i < 2000; i++) {
+        void* obj = slabAlloc(slab);
+        for (int j = 0; j < 2000; j++) {
+            if (obj == objects[j]) {
+                reused++;
+                break;
+            }
+        }
+    }
+    printf("reused %d of 2000 slots\n", reused);
+    int local = 0;
+    slabFree(slab, &local);
+    slabDestroy(slab);
+}
+
+void test_mt_batch() {
+    printf("==== test_mt_batch ====\n");
+    heapCreate();
+    void* ptrs[100];
+    size_t allocated = customMTMallocBatch(600, 100, ptrs);
+    for (size_t i = 0; i < allocated; i++) {
+        memset(ptrs[i], (int)i, 600);
+    }
+    printf("batch allocated %zu of 100 blocks\n", allocated);
+    // a duplicate and a null pointer are reported, the rest is freed
+    ptrs[1] = ptrs[0];
+    ptrs[2] = NULL;
+    customMTFreeBatch(ptrs, allocated);
+    heapKill();
+}
+
+#define TRACE_TEST_SLOTS 64
+static void* _Atomic traceTestSlots[TRACE_TEST_SLOTS];
+
+// blocks pass between threads through shared slots, so frees and moving
+// reallocs of one thread hand addresses to the others
+void* trace_worker(void* arg) {
+    unsigned int seed = (unsigned int)(uintptr_t)arg * 7919 + 1;
+    for (int i = 0; i < 20000; i++) {
+        seed = seed * 1103515245 + 12345;
+        size_t slot = (seed >> 8) % TRACE_TEST_SLOTS;
+        void* ptr = atomic_exchange(&traceTestSlots[slot], NULL);
+        if (ptr == NULL) {
+            ptr = customMTMalloc(16 + (seed >> 4) % 200);
+        } else if ((seed >> 3) & 1) {
+            customMTFree(ptr);
+            continue;
+        } else {
+            ptr = customMTRealloc(ptr, 16 + (seed >> 12) % 600);
+        }
+        void* old = atomic_exchange(&traceTestSlots[slot], ptr);
+        if (old != NULL) {
+            customMTFree(old);
+        }
+    }
+    return NULL;
+}
+
+static int compare_trace_records(const void* a, const void* b) {
+    const TraceRecord* left = (const TraceRecord*)a;
+    const TraceRecord* right = (const TraceRecord*)b;
+    if (left->time != right->time) {
+        return left->time < right->time ? -1 : 1;
+    }
+    return left < right ? -1 : left > right;
+}
+
+// in timestamp order, as the replay reads it, every free and realloc must
+// find its pointer live and no allocation may return a live pointer
+void test_trace_order() {
+    printf("==== test_trace_order ====\n");
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/my_tests_trace_%d.bin", (int)getpid());
+    heapCreate();
+    if (!customTraceStart(path)) {
+        printf("cannot start a trace\n");
+        heapKill();
+        return;
+    }
+    pthread_t th[4];
+    for (uintptr_t i = 0; i < 4; i++) {
+        pthread_create(&th[i], NULL, trace_worker, (void*)i);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(th[i], NULL);
+    }
+    for (int i = 0; i < TRACE_TEST_SLOTS; i++) {
+        void* ptr = atomic_exchange(&traceTestSlots[i], NULL);
+        if (ptr != NULL) {
+            customMTFree(ptr);
+        }
+    }
+    customTraceStop();
+    heapKill();
+
+    FILE* file = fopen(path, "rb");
+    TraceFileHeader header;
+    if (file == NULL || fread(&header, sizeof(header), 1, file) != 1) {
+        printf("cannot read the trace\n");
+        if (file != NULL) {
+            fclose(file);
+        }
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t count = ((size_t)ftell(file) - sizeof(header)) / sizeof(TraceRecord);
+    fseek(file, sizeof(header), SEEK_SET);
+    TraceRecord* records = malloc(count * sizeof(TraceRecord));
+    count = fread(records, sizeof(TraceRecord), count, file);
+    fclose(file);
+    unlink(path);
+    qsort(records, count, sizeof(TraceRecord), compare_trace_records);
+
+    unsigned long long live[TRACE_TEST_SLOTS + 16];
+    size_t liveCount = 0;
+    size_t unresolved = 0;
+    size_t reusedLive = 0;
+    for (size_t i = 0; i < count; i++) {
+        TraceRecord* record = &records[i];
+        bool consumes = record->op == TRACE_MT_FREE || record->op == TRACE_MT_REALLOC;
+        unsigned long long consumed = record->op == TRACE_MT_FREE ? record->ptr : record->arg;
+        if (consumes && consumed != 0) {
+            size_t j = 0;
+            while (j < liveCount && live[j] != consumed) {
+                j++;
+            }
+            if (j == liveCount) {
+                unresolved++;
+            } else {
+                live[j] = live[--liveCount];
+            }
+        }
+        if (!consumes && record->ptr != 0) {
+            size_t j = 0;
+            while (j < liveCount && live[j] != record->ptr) {
+                j++;
+            }
+            if (j < liveCount) {
+                reusedLive++;
+            } else if (liveCount < TRACE_TEST_SLOTS + 16) {
+                live[liveCount++] = record->ptr;
+            }
+        }
+    }
+    free(records);
+    printf("trace records: %s, unresolved: %zu, handed out while live: %zu\n", count > 0 ? "yes" : "no", unresolved,
+           reusedLive);
+}
+
+void test_malloc_stats() {
+    printf("==== test_malloc_stats ====\n");
+    MallocStats before = customMallocStats();
+    void* ptr = customMalloc(1000);
+    MallocStats during = customMallocStats();
+    printf("Part A: in use grew by %zu, blocks grew by %zu\n",
+           during.bytesInUse - before.bytesInUse, during.allocatedBlocks - before.allocatedBlocks);
+    customFree(ptr);
+    MallocStats after = customMallocStats();
+    printf("Part A: back to the same use: %s\n",
+           after.bytesInUse == before.bytesInUse && after.allocatedBlocks == before.allocatedBlocks ? "yes" : "no");
+
+    heapCreate();
+    void* ptrs[10];
+    for (int i = 0; i < 10; i++) {
+        ptrs[i] = customMTMalloc(100);
+    }
+    void* large = customMTMalloc(100000);
+    MallocStats stats = customMTMallocStats();
+    printf("Part B: %zu blocks, %zu bytes in use, %zu areas\n", stats.allocatedBlocks, stats.bytesInUse, stats.areaCount);
+    AreaStats areas[16];
+    size_t areaCount = customMTAreaStats(areas, 16);
+    size_t areaBytesFree = 0;
+    for (size_t i = 0; i < areaCount && i < 16; i++) {
+        areaBytesFree += areas[i].bytesFree;
+    }
+    printf("Part B: area free bytes add up: %s\n", areaBytesFree == stats.bytesFree ? "yes" : "no");
+    for (int i = 0; i < 10; i++) {
+        customMTFree(ptrs[i]);
+    }
+    customMTFree(large);
+    stats = customMTMallocStats();
+    printf("Part B: after free %zu blocks, %zu bytes in use\n", stats.allocatedBlocks, stats.bytesInUse);
+    heapKill();
+}
+
+#define REMOTE_FREE_BLOCKS 40
+
+void* remote_alloc_worker(void* p) {
+    void** ptrs = (void**)p;
+    for (int i = 0; i < REMOTE_FREE_BLOCKS; i++) {
+        ptrs[i] = customMTMalloc(1000);
+    }
+    return NULL;
+}
+
+void* remote_free_worker(void* p) {
+    void** ptrs = (void**)p;
+    for (int i = 0; i < REMOTE_FREE_BLOCKS; i++) {
+        customMTFree(ptrs[i]);
+    }
+    return NULL;
+}
+
+// blocks freed by another thread after their owner has exited, so no thread
+// mallocs from their area again, must still come back to it
+void test_mt_remote_free_reuse() {
+    printf("==== test_mt_remote_free_reuse ====\n");
+    HeapConfig config;
+    heapDefaultConfig(&config);
+    config.initialAreaCount = 2;
+    heapCreateWithConfig(&config);
+    AreaStats fresh[2];
+    customMTAreaStats(fresh, 2);
+    void* ptrs[REMOTE_FREE_BLOCKS];
+    pthread_t th;
+    pthread_create(&th, NULL, remote_alloc_worker, ptrs);
+    pthread_join(th, NULL);
+    pthread_create(&th, NULL, remote_free_worker, ptrs);
+    pthread_join(th, NULL);
+
+    AreaStats areas[2];
+    size_t areaCount = customMTAreaStats(areas, 2);
+    bool whole = areaCount == 2;
+    for (size_t i = 0; i < areaCount && i < 2; i++) {
+        whole = whole && areas[i].freeBlocks == 1 && areas[i].bytesFree == fresh[i].bytesFree;
+    }
+    printf("areas are whole again: %s\n", whole ? "yes" : "no");
+    // each block fills most of an area, so both areas are needed
+    void* first = customMTMalloc(50000);
+    void* second = customMTMalloc(50000);
+    printf("space used again without a new area: %s\n",
+           first != NULL && second != NULL && customMTMallocStats().areaCount == 2 ? "yes" : "no");
+    customMTFree(first);
+    customMTFree(second);
+    heapKill();
+}
+
+void test_mt_usable_size_and_fork() {
+    printf("==== test_mt_usable_size_and_fork ====\n");
+    heapCreate();
+    pthread_atfork(customMTForkPrepare, customMTForkParent, customMTForkChild);
+    void* small = customMTMalloc(100);
+    void* large = customMTMalloc(200000);
+    int local = 0;
+    printf("usable sizes cover the request: %s\n",
+           customMTUsableSize(small) >= 100 && customMTUsableSize(large) >= 200000 ? "yes" : "no");
+    printf("non-heap pointer has no usable size: %s\n", customMTUsableSize(&local) == 0 ? "yes" : "no");
+    pid_t pid = fork();
+    if (pid == 0) {
+        void* ptr = customMTMalloc(5000);
+        customMTFree(small);
+        customMTFree(ptr);
+        _exit(ptr != NULL ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    printf("child allocated after fork: %s\n", WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "yes" : "no");
+    customMTFree(small);
+    customMTFree(large);
+    printf("freed block has no usable size: %s\n", customMTUsableSize(large) == 0 ? "yes" : "no");
+    heapKill();
+}
+
+// a burst with geometric area growth: few, increasingly large areas
+void test_single_thread_config() {
+    HeapConfig config;
+    heapDefaultConfig(&config);
+    config.initialAreaCount = 2;
+    config.areaSize = 1024;
+    config.growth = AREA_GROWTH_GEOMETRIC;
+    config.maxAreaSize = 64 * 1024;
+    heapCreateWithConfig(&config);
+
+    void* ptrs[200];
+    int allocated = 0;
+    for (int i = 0; i < 200; i++) {
+        ptrs[i] = customMTMalloc(500);
+        if (ptrs[i] != NULL) {
+            memset(ptrs[i], i, 500);
+            allocated++;
+        }
+    }
+    printf("Burst allocated %d of 200 blocks\n", allocated);
+    for (int i = 0; i < 200; i++) {
+        if (ptrs[i] != NULL) {
+            customMTFree(ptrs[i]);
+        }
+    }
+    heapKill();
+}
+
 typedef struct {
   pthread_barrier_t *start_barrier;
   int threadNumber;
@@ -386,13 +850,26 @@ int main(void) {
   test_malloc_free_3();
   test_malloc_free_4();
   test_calloc();
+  test_calloc_zeroing();
+  test_free_invalid_pointer();
   test_realloc_sanity();
   test_realloc_shrink_last_block();
   test_realloc_shrink_middle_block();
   test_realloc_extend_middle_block();
+  test_realloc_extend_into_free_successor();
   test_realloc_extend_last_block();
   test_single_thread();
   test_single_thread_realloc();
+  test_single_thread_large();
+  test_region();
+  test_aligned_alloc();
+  test_slab();
+  test_mt_batch();
+  test_malloc_stats();
+  test_mt_remote_free_reuse();
+  test_mt_usable_size_and_fork();
+  test_trace_order();
+  test_single_thread_config();
   test_threads(worker);
   test_threads(worker_realloc);
   return 0;
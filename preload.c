@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include "customAllocator.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h> //for PTRDIFF_MAX
+#include <stdlib.h> //for getenv
+#include <malloc.h> //for the memalign family
+#include <unistd.h> //for sysconf
+#include <string.h> //for memcpy
+#include <errno.h> //for errno
+#include <stdatomic.h>
+#include <dlfcn.h> //for dlsym
+#include <sys/mman.h> //for mincore
+
+/*=============================================================================
+* LD_PRELOAD shim
+* built by `make preload` into libcustomAllocator.so, which replaces the
+* malloc family of an unmodified program with the MT heap:
+*     LD_PRELOAD=./libcustomAllocator.so <program>
+* the heap is created by the first call, with PRELOAD_* defaults for any
+* setting its CUSTOM_ALLOCATOR_* variable leaves unset. a call the shim makes
+* into the heap or libc while setting it up may come back into malloc on the
+* same thread; it is served from a static bootstrap buffer, whose blocks are
+* never freed. pointers outside every mapping of the heap, like ones the
+* loader got before the shim was in place, go to the next malloc in line,
+* looked up with dlsym during setup. any other pointer that is not a live
+* block, such as one freed twice, is reported by the heap as invalid. that
+* includes a large block freed twice: its mapping is gone, so it is neither
+* the heap's nor the next malloc's.
+=============================================================================*/
+#define PRELOAD_AREA_SIZE (1024 * 1024)
+#define PRELOAD_LARGE_THRESHOLD (128 * 1024)
+#define BOOTSTRAP_BUFFER_SIZE (64 * 1024)
+
+typedef struct NextMalloc
+{
+    void (*free)(void* ptr);
+    void* (*realloc)(void* ptr, size_t size);
+    size_t (*usableSize)(void* ptr);
+} NextMalloc;
+
+static NextMalloc nextMalloc;
+static pthread_once_t preloadOnce = PTHREAD_ONCE_INIT;
+static _Atomic bool preloadReady = false;
+static _Thread_local bool preloadInitializing = false;
+
+static _Alignas(PAGE_PROVIDER_ALIGNMENT) char bootstrapBuffer[BOOTSTRAP_BUFFER_SIZE];
+static _Atomic size_t bootstrapUsed = 0;
+
+/*=============================================================================
+* bootstrap buffer
+* [padding | size | payload] bump allocated; zero from the start, so calloc
+* needs no memset
+=============================================================================*/
+static inline bool isBootstrapPointer(void* ptr){
+    return (char*)ptr >= bootstrapBuffer && (char*)ptr < bootstrapBuffer + BOOTSTRAP_BUFFER_SIZE;
+}
+
+static void* bootstrapAlloc(size_t alignment, size_t size){
+    if(alignment < MALLOC_ALIGNMENT){
+        alignment = MALLOC_ALIGNMENT;
+    }
+    if(size > BOOTSTRAP_BUFFER_SIZE || alignment > BOOTSTRAP_BUFFER_SIZE){
+        return NULL;
+    }
+    size_t used = atomic_load(&bootstrapUsed);
+    size_t offset;
+    size_t end;
+    do{
+        offset = (used + sizeof(size_t) + alignment - 1) & ~(alignment - 1);
+        end = ALIGN_TO_MULT_OF_16(offset + size);
+        if(end > BOOTSTRAP_BUFFER_SIZE){
+            return NULL;
+        }
+    }while(!atomic_compare_exchange_weak(&bootstrapUsed, &used, end));
+    *(size_t*)(bootstrapBuffer + offset - sizeof(size_t)) = size;
+    return bootstrapBuffer + offset;
+}
+
+static inline size_t bootstrapSize(void* ptr){
+    return *((size_t*)ptr - 1);
+}
+
+/*=============================================================================
+* setup
+=============================================================================*/
+static size_t unlessSet(const char* name, size_t configured, size_t preloadDefault){
+    const char* value = getenv(name);
+    return value == NULL || *value == '\0' ? preloadDefault : configured;
+}
+
+static void preloadInit(){
+    HeapConfig config;
+    heapDefaultConfig(&config);
+    config.areaSize = unlessSet("CUSTOM_ALLOCATOR_AREA_SIZE", config.areaSize, PRELOAD_AREA_SIZE);
+    config.largeThreshold = unlessSet("CUSTOM_ALLOCATOR_LARGE_THRESHOLD", config.largeThreshold, PRELOAD_LARGE_THRESHOLD);
+    heapCreateWithConfig(&config);
+    if(memoryAreaList == NULL){
+        return;
+    }
+    // dlsym and pthread_atfork may both allocate
+    *(void**)&nextMalloc.free = dlsym(RTLD_NEXT, "free");
+    *(void**)&nextMalloc.realloc = dlsym(RTLD_NEXT, "realloc");
+    *(void**)&nextMalloc.usableSize = dlsym(RTLD_NEXT, "malloc_usable_size");
+    pthread_atfork(customMTForkPrepare, customMTForkParent, customMTForkChild);
+    atomic_store(&preloadReady, true);
+}
+
+// false while this thread is inside preloadInit, or when the heap could not
+// be created
+static inline bool preloadEnsure(){
+    if(atomic_load_explicit(&preloadReady, memory_order_acquire)){
+        return true;
+    }
+    if(preloadInitializing){
+        return false;
+    }
+    preloadInitializing = true;
+    pthread_once(&preloadOnce, preloadInit);
+    preloadInitializing = false;
+    return atomic_load(&preloadReady);
+}
+
+// true for pointers to hand to the next malloc: outside the heap's mappings,
+// with the chunk header in front of them still mapped
+static bool isForeignPointer(void* ptr){
+    if(customOwnsAddress(ptr)){
+        return false;
+    }
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t header = (uintptr_t)ptr - 2 * sizeof(size_t);
+    unsigned char resident;
+    int savedErrno = errno;
+    bool mapped = mincore((void*)(header & ~(page - 1)), 1, &resident) == 0 || errno != ENOMEM;
+    errno = savedErrno;
+    return mapped;
+}
+
+/*=============================================================================
+* malloc interface
+=============================================================================*/
+static void* preloadAlignedAlloc(size_t alignment, size_t size){
+    if(!preloadEnsure()){
+        return bootstrapAlloc(alignment, size);
+    }
+    if(size > PTRDIFF_MAX || alignment > PAGE_PROVIDER_ALIGNMENT){
+        return NULL;
+    }
+    return alignment <= MALLOC_ALIGNMENT ? customMTMalloc(size) : customMTAlignedAlloc(alignment, size);
+}
+
+static inline void* setNoMemory(void* ptr){
+    if(ptr == NULL){
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* malloc(size_t size){
+    return setNoMemory(preloadAlignedAlloc(MALLOC_ALIGNMENT, size));
+}
+
+void free(void* ptr){
+    if(ptr == NULL || isBootstrapPointer(ptr)){
+        return;
+    }
+    if(isForeignPointer(ptr)){
+        preloadEnsure();
+        if(nextMalloc.free != NULL){
+            nextMalloc.free(ptr);
+        }
+        return;
+    }
+    customMTFree(ptr);
+}
+
+void* calloc(size_t nmemb, size_t size){
+    size_t total;
+    if(__builtin_mul_overflow(nmemb, size, &total)){
+        errno = ENOMEM;
+        return NULL;
+    }
+    if(!preloadEnsure()){
+        return setNoMemory(bootstrapAlloc(MALLOC_ALIGNMENT, total));
+    }
+    if(total > PTRDIFF_MAX){
+        errno = ENOMEM;
+        return NULL;
+    }
+    return setNoMemory(customMTCalloc(nmemb, size));
+}
+
+void* realloc(void* ptr, size_t size){
+    if(ptr == NULL){
+        return malloc(size);
+    }
+    if(isBootstrapPointer(ptr)){
+        // the heap may not be up yet, so this goes through malloc
+        void* newPtr = malloc(size);
+        if(newPtr != NULL){
+            size_t oldSize = bootstrapSize(ptr);
+            memcpy(newPtr, ptr, oldSize < size ? oldSize : size);
+        }
+        return newPtr;
+    }
+    if(isForeignPointer(ptr)){
+        preloadEnsure();
+        if(nextMalloc.realloc == NULL){
+            errno = ENOMEM;
+            return NULL;
+        }
+        return nextMalloc.realloc(ptr, size);
+    }
+    if(size > PTRDIFF_MAX){
+        errno = ENOMEM;
+        return NULL;
+    }
+    return setNoMemory(customMTRealloc(ptr, size));
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size){
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void*) != 0){
+        return EINVAL;
+    }
+    void* ptr = preloadAlignedAlloc(alignment, size);
+    if(ptr == NULL){
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size){
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0){
+        errno = EINVAL;
+        return NULL;
+    }
+    return setNoMemory(preloadAlignedAlloc(alignment, size));
+}
+
+// obsolete forms glibc still exports, served here so their blocks stay in
+// the heap too
+void* memalign(size_t alignment, size_t size){
+    return aligned_alloc(alignment, size);
+}
+
+void* valloc(size_t size){
+    return setNoMemory(preloadAlignedAlloc(sysconf(_SC_PAGESIZE), size));
+}
+
+void* pvalloc(size_t size){
+    size_t page = sysconf(_SC_PAGESIZE);
+    return setNoMemory(preloadAlignedAlloc(page, (size + page - 1) & ~(page - 1)));
+}
+
+size_t malloc_usable_size(void* ptr){
+    if(ptr == NULL){
+        return 0;
+    }
+    if(isBootstrapPointer(ptr)){
+        return bootstrapSize(ptr);
+    }
+    if(isForeignPointer(ptr)){
+        preloadEnsure();
+        return nextMalloc.usableSize != NULL ? nextMalloc.usableSize(ptr) : 0;
+    }
+    return customMTUsableSize(ptr);
+}
@@ -0,0 +1,349 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <sys/mman.h> //for mmap - keeps bookkeeping off the heap
+#include <time.h>
+#include "customAllocator.h"
+#include <pthread.h>
+#include <sched.h> //for sched_yield
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+/*=============================================================================
+* replays a trace written by customTraceStart against the allocator.
+* usage: replay <trace file> [--single]
+* each traced thread gets a thread of its own, unless --single runs every
+* record on the main thread in timestamp order. a free or realloc waits for
+* the call that produced its pointer, which may be on another thread. a
+* realloc runs at its first record; its return record hands the result on.
+* Part A calls are serialized, the single thread heap takes no locks.
+=============================================================================*/
+#define NO_SOURCE ((size_t)-1)
+#define RECORD_REPLAYED (1)
+#define RECORD_SKIPPED (2)
+#define RECORD_FORWARDED (3) // realloc return, holding the result of its call
+
+typedef struct {
+  TraceRecord* records; // sorted by time
+  size_t count;
+  size_t* sources; // record whose result a free or realloc consumes; a realloc's for its return
+  size_t unresolved; // frees and reallocs of a pointer no record produced
+  void* _Atomic* results;
+  _Atomic int* ready; // RECORD_REPLAYED or RECORD_SKIPPED once results[i] is valid
+  unsigned long long* latencies; // ns per replayed call
+  unsigned int threadCount;
+} replay_t;
+
+static replay_t replay;
+// every use of the Part A heap: the MT heap keeps its bookkeeping out of it
+static pthread_mutex_t partAMutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic size_t liveBytes = 0;
+static _Atomic size_t peakLiveBytes = 0;
+
+static double nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void* mapArray(size_t bytes) {
+  void* ptr = mmap(NULL, bytes == 0 ? 1 : bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return ptr;
+}
+
+/*=============================================================================
+* loading
+=============================================================================*/
+static int compareRecords(const void* a, const void* b) {
+  const TraceRecord* left = (const TraceRecord*)a;
+  const TraceRecord* right = (const TraceRecord*)b;
+  if (left->time != right->time) {
+    return left->time < right->time ? -1 : 1;
+  }
+  // same tick: keep each thread's own records in file order
+  return left < right ? -1 : left > right;
+}
+
+static void loadTrace(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    exit(1);
+  }
+  TraceFileHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+      header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+    fprintf(stderr, "%s: not a trace file of this allocator\n", path);
+    exit(1);
+  }
+  fseek(file, 0, SEEK_END);
+  size_t count = ((size_t)ftell(file) - sizeof(header)) / sizeof(TraceRecord);
+  fseek(file, sizeof(header), SEEK_SET);
+  replay.records = (TraceRecord*)mapArray(count * sizeof(TraceRecord));
+  replay.count = fread(replay.records, sizeof(TraceRecord), count, file);
+  fclose(file);
+  // qsort is not stable, so equal timestamps fall back to the file position
+  qsort(replay.records, replay.count, sizeof(TraceRecord), compareRecords);
+}
+
+static bool isFree(const TraceRecord* record) {
+  return record->op == TRACE_FREE || record->op == TRACE_MT_FREE;
+}
+
+static bool isRealloc(const TraceRecord* record) {
+  return record->op == TRACE_REALLOC || record->op == TRACE_MT_REALLOC;
+}
+
+static bool isReallocReturn(const TraceRecord* record) {
+  return record->op == TRACE_REALLOC_RETURN || record->op == TRACE_MT_REALLOC_RETURN;
+}
+
+static bool isPartA(const TraceRecord* record) {
+  return record->op <= TRACE_ALIGNED_ALLOC;
+}
+
+static size_t recordBytes(const TraceRecord* record) {
+  if (record->op == TRACE_CALLOC || record->op == TRACE_MT_CALLOC) {
+    return (size_t)(record->size * record->arg);
+  }
+  return isFree(record) ? 0 : (size_t)record->size;
+}
+
+// open addressing map from a traced pointer to the record that produced it
+typedef struct {
+  unsigned long long ptr;
+  size_t record;
+} ptr_entry_t;
+
+static size_t hashPtr(unsigned long long ptr, size_t mask) {
+  return (size_t)((ptr >> 4) * 0x9E3779B97F4A7C15ULL) & mask;
+}
+
+// links every free and realloc to the allocation of its pointer. pointers
+// allocated before the trace started have no source and are skipped. a
+// realloc return is linked to its realloc, the thread's record before it
+static void resolveSources() {
+  size_t capacity = 1024;
+  while (capacity < replay.count * 2) {
+    capacity *= 2;
+  }
+  size_t mask = capacity - 1;
+  ptr_entry_t* table = (ptr_entry_t*)mapArray(capacity * sizeof(ptr_entry_t));
+  replay.sources = (size_t*)mapArray(replay.count * sizeof(size_t));
+  unsigned int maxThread = 0;
+  for (size_t i = 0; i < replay.count; i++) {
+    if (replay.records[i].thread > maxThread) {
+      maxThread = replay.records[i].thread;
+    }
+  }
+  size_t* lastRecord = (size_t*)mapArray(((size_t)maxThread + 1) * sizeof(size_t));
+  for (size_t i = 0; i < replay.count; i++) {
+    TraceRecord* record = &replay.records[i];
+    replay.sources[i] = NO_SOURCE;
+    if (isReallocReturn(record)) {
+      replay.sources[i] = lastRecord[record->thread];
+    }
+    lastRecord[record->thread] = i;
+    unsigned long long consumed = isFree(record) ? record->ptr : isRealloc(record) ? record->arg : 0;
+    if (consumed != 0) {
+      size_t slot = hashPtr(consumed, mask);
+      while (table[slot].ptr != 0 && table[slot].ptr != consumed) {
+        slot = (slot + 1) & mask;
+      }
+      if (table[slot].ptr == consumed) {
+        replay.sources[i] = table[slot].record;
+        // backward shift deletion keeps the probe chains intact
+        size_t hole = slot;
+        for (size_t next = (hole + 1) & mask; table[next].ptr != 0; next = (next + 1) & mask) {
+          size_t home = hashPtr(table[next].ptr, mask);
+          if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table[hole] = table[next];
+            hole = next;
+          }
+        }
+        table[hole].ptr = 0;
+      } else {
+        replay.unresolved++;
+      }
+    }
+    if (!isFree(record) && !isRealloc(record) && record->ptr != 0) {
+      size_t slot = hashPtr(record->ptr, mask);
+      while (table[slot].ptr != 0 && table[slot].ptr != record->ptr) {
+        slot = (slot + 1) & mask;
+      }
+      table[slot].ptr = record->ptr;
+      table[slot].record = i;
+    }
+  }
+  munmap(lastRecord, ((size_t)maxThread + 1) * sizeof(size_t));
+  munmap(table, capacity * sizeof(ptr_entry_t));
+  replay.threadCount = replay.count == 0 ? 0 : maxThread + 1;
+  replay.results = (void* _Atomic*)mapArray(replay.count * sizeof(void*));
+  replay.ready = (_Atomic int*)mapArray(replay.count * sizeof(int));
+  replay.latencies = (unsigned long long*)mapArray(replay.count * sizeof(unsigned long long));
+}
+
+/*=============================================================================
+* replaying
+=============================================================================*/
+static void trackLiveBytes(size_t added, size_t removed) {
+  size_t live = atomic_fetch_add(&liveBytes, added - removed) + added - removed;
+  size_t peak = atomic_load(&peakLiveBytes);
+  while (live > peak && !atomic_compare_exchange_weak(&peakLiveBytes, &peak, live)) {
+  }
+}
+
+static void* replayCall(const TraceRecord* record, void* source) {
+  switch (record->op) {
+    case TRACE_MALLOC: return customMalloc(record->size);
+    case TRACE_FREE: customFree(source); return NULL;
+    case TRACE_CALLOC: return customCalloc(record->arg, record->size);
+    case TRACE_REALLOC: return customRealloc(source, record->size);
+    case TRACE_ALIGNED_ALLOC: return customAlignedAlloc(record->arg, record->size);
+    case TRACE_MT_MALLOC: return customMTMalloc(record->size);
+    case TRACE_MT_FREE: customMTFree(source); return NULL;
+    case TRACE_MT_CALLOC: return customMTCalloc(record->arg, record->size);
+    case TRACE_MT_REALLOC: return customMTRealloc(source, record->size);
+    case TRACE_MT_ALIGNED_ALLOC: return customMTAlignedAlloc(record->arg, record->size);
+    default: return NULL;
+  }
+}
+
+static void replayRecord(size_t i) {
+  const TraceRecord* record = &replay.records[i];
+  size_t source = replay.sources[i];
+  void* sourcePtr = NULL;
+  size_t sourceBytes = 0;
+  if (source != NO_SOURCE) {
+    // produced on another thread: wait for it
+    while (!atomic_load_explicit(&replay.ready[source], memory_order_acquire)) {
+      sched_yield();
+    }
+    sourcePtr = atomic_load_explicit(&replay.results[source], memory_order_relaxed);
+    sourceBytes = recordBytes(&replay.records[source]);
+  }
+  if (isReallocReturn(record)) {
+    atomic_store_explicit(&replay.results[i], sourcePtr, memory_order_relaxed);
+    atomic_store_explicit(&replay.ready[i], RECORD_FORWARDED, memory_order_release);
+    return;
+  }
+  // frees of memory from before the trace, or of nothing, are not replayed
+  if ((isFree(record) && sourcePtr == NULL) || (record->ptr == 0 && record->arg == 0 && isRealloc(record))) {
+    atomic_store_explicit(&replay.ready[i], RECORD_SKIPPED, memory_order_release);
+    return;
+  }
+  bool partA = isPartA(record) && replay.threadCount > 1;
+  if (partA) {
+    pthread_mutex_lock(&partAMutex);
+  }
+  double start = nowNs();
+  void* result = replayCall(record, sourcePtr);
+  replay.latencies[i] = (unsigned long long)(nowNs() - start);
+  if (partA) {
+    pthread_mutex_unlock(&partAMutex);
+  }
+  // a realloc that fails keeps its block, one to size 0 frees it
+  bool released = sourcePtr != NULL && (result != NULL || isFree(record) || record->size == 0);
+  trackLiveBytes(result != NULL ? recordBytes(record) : 0, released ? sourceBytes : 0);
+  atomic_store_explicit(&replay.results[i], result, memory_order_relaxed);
+  atomic_store_explicit(&replay.ready[i], RECORD_REPLAYED, memory_order_release);
+}
+
+typedef struct {
+  pthread_barrier_t* startBarrier;
+  unsigned int thread;
+} replay_arg_t;
+
+void* replay_worker(void* p) {
+  replay_arg_t* a = (replay_arg_t*)p;
+  pthread_barrier_wait(a->startBarrier);
+  for (size_t i = 0; i < replay.count; i++) {
+    if (replay.records[i].thread == a->thread) {
+      replayRecord(i);
+    }
+  }
+  pthread_barrier_wait(a->startBarrier);
+  return NULL;
+}
+
+static double replayThreads() {
+  unsigned int threads = replay.threadCount;
+  pthread_t* th = (pthread_t*)mapArray(threads * sizeof(pthread_t));
+  replay_arg_t* args = (replay_arg_t*)mapArray(threads * sizeof(replay_arg_t));
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, threads + 1);
+  for (unsigned int i = 0; i < threads; i++) {
+    args[i].startBarrier = &barrier;
+    args[i].thread = i;
+    pthread_create(&th[i], NULL, replay_worker, &args[i]);
+  }
+  heapCreate();
+  pthread_barrier_wait(&barrier);
+  double start = nowNs();
+  pthread_barrier_wait(&barrier);
+  double elapsed = nowNs() - start;
+  for (unsigned int i = 0; i < threads; i++) {
+    pthread_join(th[i], NULL);
+  }
+  pthread_barrier_destroy(&barrier);
+  return elapsed;
+}
+
+static double replaySingle() {
+  replay.threadCount = 1;
+  heapCreate();
+  double start = nowNs();
+  for (size_t i = 0; i < replay.count; i++) {
+    replayRecord(i);
+  }
+  return nowNs() - start;
+}
+
+/*=============================================================================
+* report
+=============================================================================*/
+static int compareLatencies(const void* a, const void* b) {
+  unsigned long long left = *(const unsigned long long*)a;
+  unsigned long long right = *(const unsigned long long*)b;
+  return left < right ? -1 : left > right;
+}
+
+static void report(double elapsed) {
+  size_t calls = 0;
+  for (size_t i = 0; i < replay.count; i++) {
+    if (atomic_load(&replay.ready[i]) == RECORD_REPLAYED) {
+      replay.latencies[calls++] = replay.latencies[i];
+    }
+  }
+  qsort(replay.latencies, calls, sizeof(unsigned long long), compareLatencies);
+  printf("records: %zu  threads: %u  replayed calls: %zu  unresolved: %zu\n", replay.count, replay.threadCount, calls,
+         replay.unresolved);
+  printf("throughput: %.2f Mops/s over %.1f ms\n", elapsed > 0 ? (double)calls / elapsed * 1e3 : 0.0, elapsed / 1e6);
+  if (calls != 0) {
+    printf("latency ns: p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+           replay.latencies[calls / 2], replay.latencies[calls * 9 / 10], replay.latencies[calls * 99 / 100],
+           replay.latencies[calls * 999 / 1000], replay.latencies[calls - 1]);
+  }
+  MallocStats partA = customMallocStats();
+  MallocStats partB = customMTMallocStats();
+  printf("peak live bytes: %zu\n", atomic_load(&peakLiveBytes));
+  printf("peak heap bytes: %zu single thread heap, %zu multi thread heap\n", partA.peakHeapBytes, partB.peakHeapBytes);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <trace file> [--single]\n", argv[0]);
+    return 1;
+  }
+  bool single = argc > 2 && strcmp(argv[2], "--single") == 0;
+  loadTrace(argv[1]);
+  resolveSources();
+  double elapsed = single ? replaySingle() : replayThreads();
+  report(elapsed);
+  heapKill();
+  return 0;
+}